@@ -0,0 +1,683 @@
+
+#define _GNU_SOURCE  /* for FNM_CASEFOLD */
+
+#include <fnmatch.h>
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wildmatch.h"
+
+/* About the benchmark
+ *
+ * Each case is a pattern (with flags) matched against every string
+ * of a corpus. The corpora are generated from a fixed seed, so all
+ * runs see the same strings: file paths, dictionary-like words, long
+ * lines of text, and words with many non-ASCII characters.
+ *
+ * A case is run with every engine that supports what the pattern
+ * and the corpus need: wildmatch itself and its other ways to match
+ * (a compiled pattern, its automaton, a set of one pattern, and the
+ * thread pool, which is timed in larger batches) support all, the
+ * stages (rmatch and imatch1..6, which is wildmatch as it grew)
+ * support ever more, libc's fnmatch supports all but globstars. A run is one warmup pass over the corpus and
+ * then a number of timed passes, each timed in batches of strings;
+ * the table shows the median and 99th percentile time per match
+ * over all batches, the throughput over all passes, and the number
+ * of matching strings (engines may differ in their rules).
+ *
+ * With -a, adversarial cases are run instead: a pattern and a string
+ * built to make backtracking work hard, for a size (of the string or
+ * of the pattern) that doubles from row to row. Each row shows the
+ * steps taken by wildmatch's matcher (counted when compiled with
+ * WILDMATCH_STATS) and the time per match; the exponent k of the
+ * growth (steps ~ size^k) is fitted by least squares on the log-log
+ * curve. Each case has a bound for k: if the steps grow faster, the
+ * case is marked and the program exits with status 1.
+ */
+
+#define BATCH  64              /* strings per timed sample */
+#define POOLBATCH 4096         /* the same for the thread pool */
+#define MINTIME 2e6            /* ns to repeat an adversarial match */
+
+bool rmatch(const char *pat, const char *str);
+bool imatch1(const char *pat, const char *str);
+bool imatch2(const char *pat, const char *str);
+int iterative3_wildmatch(const char *pat, const char *str, int flags);
+int iterative4_wildmatch(const char *pat, const char *str, int flags);
+int iterative5_wildmatch(const char *pat, const char *str, int flags);
+int iterative6_wildmatch(const char *pat, const char *str, int flags);
+
+enum { F_CLASS = 1, F_FOLD = 2, F_PATH = 4, F_PERIOD = 8, F_UTF8 = 16,
+       F_GLOBSTAR = 32, F_UNIFOLD = 64, F_STRICT = 128, F_BYTES = 256,
+       F_ALL = 511 };
+
+struct corpus {
+  const char *name;
+  char **str;
+  size_t n;
+  bool utf8;                   /* has non-ASCII characters */
+};
+
+struct bcase {
+  int corpus;                  /* index into corpora */
+  const char *pat;
+  int flags;
+};
+
+/* how an engine matches: calls match, or uses wildmatch's interface */
+enum { E_CALL, E_COMPILED, E_DFA, E_SET, E_POOL };
+
+struct engine {
+  const char *name;
+  int features;                /* what it supports */
+  int (*match)(const char *pat, const char *str, int flags);
+  int how;                     /* E_CALL, ... */
+};
+
+/** what an engine matches with, made from the pattern */
+struct matcher {
+  struct wildprog *prog;       /* E_COMPILED, E_DFA, E_POOL */
+  struct wilddfa *dfa;
+  struct wildset *set;
+  struct wildpool *pool;
+  uint64_t *bits;              /* E_POOL: results of a batch */
+};
+
+static int
+do_rmatch(const char *pat, const char *str, int flags)
+{
+  (void) flags;
+  return rmatch(pat, str);
+}
+
+static int
+do_imatch1(const char *pat, const char *str, int flags)
+{
+  (void) flags;
+  return imatch1(pat, str);
+}
+
+static int
+do_imatch2(const char *pat, const char *str, int flags)
+{
+  (void) flags;
+  return imatch2(pat, str);
+}
+
+static int
+do_fnmatch(const char *pat, const char *str, int flags)
+{
+  int fnflags = 0;
+  if (flags & WILD_CASEFOLD) fnflags |= FNM_CASEFOLD;
+  if (flags & WILD_PATHNAME) fnflags |= FNM_PATHNAME;
+  if (flags & WILD_PERIOD) fnflags |= FNM_PERIOD;
+  return fnmatch(pat, str, fnflags) == 0;
+}
+
+static struct engine engines[] = {
+  { "wildmatch",   F_ALL, wildmatch, E_CALL },
+  { "compiled",    F_ALL, 0, E_COMPILED },
+  { "dfa",         F_ALL, 0, E_DFA },
+  { "wildset",     F_ALL, 0, E_SET },
+  { "pool",        F_ALL, 0, E_POOL },
+  { "rmatch",      0, do_rmatch, E_CALL },
+  { "imatch1",     0, do_imatch1, E_CALL },
+  { "imatch2",     F_CLASS, do_imatch2, E_CALL },
+  { "imatch3",     F_CLASS|F_FOLD, iterative3_wildmatch, E_CALL },
+  { "imatch4",     F_CLASS|F_FOLD|F_PATH|F_GLOBSTAR, iterative4_wildmatch, E_CALL },
+  { "imatch5",     F_ALL & ~(F_UTF8|F_UNIFOLD|F_STRICT|F_BYTES), iterative5_wildmatch, E_CALL },
+  { "imatch6",     F_ALL & ~(F_UNIFOLD|F_STRICT|F_BYTES), iterative6_wildmatch, E_CALL },
+  { "fnmatch",     F_ALL & ~(F_GLOBSTAR|F_UNIFOLD|F_STRICT|F_BYTES), do_fnmatch, E_CALL },
+};
+
+#define NENGINE (sizeof engines / sizeof *engines)
+
+enum { C_PATHS, C_WORDS, C_LINES, C_UTF8, C_CJK };
+
+static struct corpus corpora[] = {
+  { "paths", 0, 0, false },
+  { "words", 0, 0, false },
+  { "lines", 0, 0, false },
+  { "utf8",  0, 0, true },
+  { "cjk",   0, 0, true },
+};
+
+static const struct bcase cases[] = {
+  { C_PATHS, "*.c", 0 },
+  { C_PATHS, "src/**/*.c", WILD_PATHNAME },
+  { C_PATHS, "*/test/*", WILD_PATHNAME },
+  { C_PATHS, "**/vendor/**", WILD_PATHNAME },
+  { C_PATHS, "*[0-9].h", 0 },
+  { C_PATHS, "SRC/*/*.C", WILD_PATHNAME|WILD_CASEFOLD },
+  { C_PATHS, "*/.*", WILD_PATHNAME|WILD_PERIOD },
+  { C_PATHS, "docs/readme.md", 0 },
+  { C_WORDS, "*ing", 0 },
+  { C_WORDS, "a*b*c*", 0 },
+  { C_WORDS, "?????", 0 },
+  { C_WORDS, "[aeiou]*[!aeiou]", 0 },
+  { C_WORDS, "*TION", WILD_CASEFOLD },
+  { C_WORDS, "*a*e*i", 0 },
+  { C_LINES, "*needle*", 0 },
+  { C_LINES, "*a*b*c*d*e*f*", 0 },
+  { C_LINES, "*[xyz]", 0 },
+  { C_LINES, "*q?z*", 0 },
+  { C_UTF8,  "*\xc3\xa4*", 0 },
+  { C_UTF8,  "??\xe2\x82\xac*", 0 },
+  { C_UTF8,  "*[\xc3\xa4\xc3\xb6\xc3\xbc]?", 0 },
+  { C_UTF8,  "*\xc3\x89*", WILD_CASEFOLD },
+  { C_UTF8,  "*\xc3\x89*", WILD_UNIFOLD },
+  { C_UTF8,  "*\xc3\xa4*", WILD_BYTES },
+  { C_UTF8,  "*[\xc3\xa4\xc3\xb6\xc3\xbc]?", WILD_BYTES },
+  { C_CJK,   "*\xe6\x96\x87\xe4\xbb\xb6*", 0 },
+  { C_CJK,   "*\xe6\x96\x87\xe4\xbb\xb6*", WILD_STRICT },
+  { C_CJK,   "*[\xe4\xb8\x80-\xe4\xb9\x80]?", WILD_STRICT },
+  { C_CJK,   "*\xe6\x96\x87\xe4\xbb\xb6*", WILD_BYTES },
+};
+
+#define NCASE (sizeof cases / sizeof *cases)
+
+static uint64_t seed = 0x2545f4914f6cdd1d;
+
+/** return next pseudo-random number (splitmix64) */
+static uint64_t
+rnd(void)
+{
+  uint64_t z = (seed += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+/** return random number below n */
+static size_t
+below(size_t n)
+{
+  return (size_t) (rnd() % n);
+}
+
+static void *
+xmalloc(size_t n)
+{
+  void *p = malloc(n);
+  if (!p) {
+    fprintf(stderr, "bench: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/** append a random word of syllables (with given alphabet) to buf */
+static size_t
+word(char *buf, const char *const *syl, size_t nsyl, int minsyl, int maxsyl)
+{
+  size_t len = 0, k, n = minsyl + below(maxsyl - minsyl + 1);
+  for (k = 0; k < n; k++) {
+    const char *s = syl[below(nsyl)];
+    memcpy(buf + len, s, strlen(s));
+    len += strlen(s);
+  }
+  return len;
+}
+
+/** fill corpus with n strings made by gen into one block of memory */
+static void
+fill(struct corpus *c, size_t n, size_t maxlen, size_t (*gen)(char *buf))
+{
+  char *mem = xmalloc(n * (maxlen + 1));
+  size_t i, len;
+  c->str = xmalloc(n * sizeof *c->str);
+  c->n = n;
+  for (i = 0; i < n; i++) {
+    len = gen(mem);
+    mem[len] = 0;
+    c->str[i] = mem;
+    mem += len + 1;
+  }
+}
+
+static const char *const syllables[] = {
+  "a", "ab", "ac", "al", "an", "ar", "be", "ca", "ce", "co", "de", "di",
+  "e", "el", "en", "er", "es", "fi", "ga", "in", "ing", "is", "la", "le",
+  "li", "lo", "ma", "me", "mi", "na", "ne", "ni", "no", "o", "on", "or",
+  "pa", "pe", "po", "ra", "re", "ri", "ro", "sa", "se", "si", "ta", "te",
+  "ti", "tion", "to", "tu", "u", "un", "ur", "va", "ve", "qu", "x", "y"
+};
+
+static const char *const dirs[] = {
+  "src", "lib", "test", "vendor", "include", "docs", "build", "tools",
+  "core", "util", "net", "io", ".git", ".cache", "SRC", "app"
+};
+
+static const char *const exts[] = {
+  ".c", ".h", ".o", ".py", ".md", ".txt", ".json", ".C", "", ".cc"
+};
+
+static const char *const utfsyl[] = {
+  "\xc3\xa4", "\xc3\xb6", "\xc3\xbc", "\xc3\xa9", "\xc3\x89", "\xe2\x82\xac",
+  "\xce\xb1", "\xce\xb2", "\xd0\xb6", "\xe6\x96\x87", "\xf0\x9f\x98\x80",
+  "a", "e", "n", "r", "s", "t"
+};
+
+static const char *const cjksyl[] = {
+  "\xe4\xb8\xad", "\xe6\x96\x87", "\xe5\xad\x97", "\xe4\xbb\xb6",
+  "\xe7\x9b\xae", "\xe5\xbd\x95", "\xe6\xb5\x8b", "\xe8\xaf\x95",
+  "\xe6\x95\xb0", "\xe6\x8d\xae", "\xe4\xb8\x80", "\xe7\xa8\x8b"
+};
+
+#define COUNT(a) (sizeof (a) / sizeof *(a))
+
+static size_t
+genpath(char *buf)
+{
+  size_t len = 0, k, n = 1 + below(6);
+  for (k = 0; k + 1 < n; k++) {
+    if (below(3) == 0) {
+      const char *d = dirs[below(COUNT(dirs))];
+      memcpy(buf + len, d, strlen(d));
+      len += strlen(d);
+    }
+    else len += word(buf + len, syllables, COUNT(syllables), 1, 3);
+    buf[len++] = '/';
+  }
+  if (below(8) == 0) buf[len++] = '.';
+  len += word(buf + len, syllables, COUNT(syllables), 1, 4);
+  if (below(4) == 0) buf[len++] = (char) ('0' + below(10));
+  k = below(COUNT(exts));
+  memcpy(buf + len, exts[k], strlen(exts[k]));
+  return len + strlen(exts[k]);
+}
+
+static size_t
+genword(char *buf)
+{
+  return word(buf, syllables, COUNT(syllables), 1, 5);
+}
+
+static size_t
+genline(char *buf)
+{
+  size_t len = 0;
+  while (len < 4000) {
+    len += word(buf + len, syllables, COUNT(syllables), 1, 4);
+    buf[len++] = ' ';
+  }
+  if (below(16) == 0) {
+    memcpy(buf + 2000, "needle", 6);
+  }
+  return len;
+}
+
+static size_t
+genutf8(char *buf)
+{
+  return word(buf, utfsyl, COUNT(utfsyl), 2, 10);
+}
+
+static size_t
+gencjk(char *buf)
+{
+  size_t len = 0;
+  while (len < 500) {
+    len += word(buf + len, cjksyl, COUNT(cjksyl), 2, 6);
+    buf[len++] = below(8) ? ' ' : '.';
+  }
+  return len;
+}
+
+/** return what pattern pat with flags needs on corpus c */
+static int
+needs(const char *pat, int flags, const struct corpus *c)
+{
+  int need = 0;
+  const char *p;
+  if (strchr(pat, '[')) need |= F_CLASS;
+  if (flags & WILD_CASEFOLD) need |= F_FOLD;
+  if (flags & WILD_UNIFOLD) need |= F_UNIFOLD;
+  if (flags & WILD_STRICT) need |= F_STRICT;
+  if (flags & WILD_BYTES) need |= F_BYTES;
+  if (flags & WILD_PATHNAME) need |= F_PATH;
+  if (flags & WILD_PERIOD) need |= F_PERIOD;
+  if ((flags & WILD_PATHNAME) && strstr(pat, "**")) need |= F_GLOBSTAR;
+  if (c->utf8) need |= F_UTF8;
+  for (p = pat; *p; p++)
+    if (*p & 0x80) need |= F_UTF8;
+  return need;
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/** make what engine e matches pattern bc with */
+static void
+prepare(const struct engine *e, const struct bcase *bc, size_t n, struct matcher *m)
+{
+  bool ok = true;
+  memset(m, 0, sizeof *m);
+  if (e->how == E_COMPILED || e->how == E_DFA || e->how == E_POOL)
+    ok = (m->prog = wildmatch_compile(bc->pat, bc->flags)) != 0;
+  if (ok && e->how == E_DFA)
+    ok = (m->dfa = wilddfa_new(m->prog, 0)) != 0;
+  if (ok && e->how == E_SET)
+    ok = (m->set = wildset_new()) && wildset_add(m->set, bc->pat, bc->flags) >= 0;
+  if (ok && e->how == E_POOL) {
+    m->bits = xmalloc((n + 63) / 64 * sizeof *m->bits);
+    ok = (m->pool = wildpool_new(0)) != 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "bench: out of memory\n");
+    exit(1);
+  }
+}
+
+/** release what prepare made */
+static void
+unprepare(struct matcher *m)
+{
+  wilddfa_free(m->dfa);
+  wildset_free(m->set);
+  wildpool_free(m->pool);
+  wildmatch_free(m->prog);
+  free(m->bits);
+}
+
+/** match strings lo..hi-1, return number of matches */
+static size_t
+pass(const struct engine *e, const struct matcher *m, const struct bcase *bc,
+     char **str, size_t lo, size_t hi)
+{
+  size_t i, hits = 0;
+  switch (e->how) {
+    case E_COMPILED:
+      for (i = lo; i < hi; i++)
+        hits += wildmatch_exec(m->prog, str[i]) != 0;
+      break;
+    case E_DFA:
+      for (i = lo; i < hi; i++)
+        hits += wilddfa_exec(m->dfa, str[i]) != 0;
+      break;
+    case E_SET:
+      for (i = lo; i < hi; i++)
+        hits += wildset_matchany(m->set, str[i]) != 0;
+      break;
+    case E_POOL:
+      hits = wildpool_batch(m->pool, m->prog, (const char *const *) str + lo,
+                            hi - lo, m->bits);
+      break;
+    default:
+      for (i = lo; i < hi; i++)
+        hits += e->match(bc->pat, str[i], bc->flags) != 0;
+  }
+  return hits;
+}
+
+/** run case bc with engine e and print a table row */
+static void
+run(const struct engine *e, const struct bcase *bc, int reps)
+{
+  const struct corpus *c = &corpora[bc->corpus];
+  struct matcher m;
+  size_t batch = e->how == E_POOL ? POOLBATCH : BATCH;
+  size_t nbatch = (c->n + batch - 1) / batch;
+  size_t nsample = nbatch * reps, k = 0, hits = 0, b, lo, hi;
+  double *sample = xmalloc(nsample * sizeof *sample);
+  double t, total = 0, med, p99;
+  int r;
+
+  prepare(e, bc, c->n, &m);
+  pass(e, &m, bc, c->str, 0, c->n);  /* warmup */
+  for (r = 0; r < reps; r++) {
+    hits = 0;
+    for (b = 0; b < nbatch; b++) {
+      lo = b * batch;
+      hi = lo + batch < c->n ? lo + batch : c->n;
+      t = now();
+      hits += pass(e, &m, bc, c->str, lo, hi);
+      t = now() - t;
+      total += t;
+      sample[k++] = t / (hi - lo);
+    }
+  }
+
+  qsort(sample, nsample, sizeof *sample, cmpdouble);
+  med = sample[nsample / 2];
+  p99 = sample[(size_t) (0.99 * (nsample - 1))];
+  printf("%-6s %-22s %-5d %-10s %10.1f %10.1f %10.2f %8zu\n",
+         c->name, bc->pat, bc->flags, e->name, med, p99,
+         c->n * reps / total * 1e3, hits);
+
+  unprepare(&m);
+  free(sample);
+}
+
+struct adversary {
+  const char *name;
+  size_t (*gen)(char *pat, char *str, size_t n);  /* return room used */
+  int flags;
+  size_t lo, hi;               /* sizes, doubling */
+  const char *size;            /* what the size is */
+  double bound;                /* largest exponent allowed */
+};
+
+/** append c n times to buf, return end */
+static char *
+rep(char *buf, const char *c, size_t n)
+{
+  size_t len = strlen(c);
+  while (n-- > 0) {
+    memcpy(buf, c, len);
+    buf += len;
+  }
+  *buf = 0;
+  return buf;
+}
+
+/* star before a long run of literals, string just short of it */
+static size_t
+adv_anchor(char *pat, char *str, size_t n)
+{
+  strcpy(rep(rep(pat, "*", 1), "a", 16), "[!a]");
+  rep(str, "a", n);
+  return n;
+}
+
+/* same, with the run of literals growing */
+static size_t
+adv_run(char *pat, char *str, size_t n)
+{
+  strcpy(rep(rep(pat, "*", 1), "a", n), "[!a]");
+  rep(str, "a", 4096);
+  return n;
+}
+
+/* many stars, each of which could end anywhere */
+static size_t
+adv_stars(char *pat, char *str, size_t n)
+{
+  strcpy(rep(pat, "*a", 8), "*[!a]");
+  rep(str, "a", n);
+  return n;
+}
+
+/* same with non-ASCII characters, which need decoding */
+static size_t
+adv_utf8(char *pat, char *str, size_t n)
+{
+  strcpy(rep(pat, "*\xc3\xa9", 8), "*[!\xc3\xa9]");
+  rep(str, "\xc3\xa9", n);
+  return n;
+}
+
+/* globstars against a deep path, failing at the end */
+static size_t
+adv_deep(char *pat, char *str, size_t n)
+{
+  strcpy(rep(pat, "**/a/", 4), "**/[b]");
+  rep(str, "a/", n)[-1] = 0;
+  return n;
+}
+
+/* growing number of globstars against a fixed deep path */
+static size_t
+adv_globs(char *pat, char *str, size_t n)
+{
+  strcpy(rep(pat, "**/a/", n), "**/[b]");
+  rep(str, "a/", 256)[-1] = 0;
+  return n;
+}
+
+/* growing class of non-ASCII ranges, matched at every position */
+static size_t
+adv_class(char *pat, char *str, size_t n)
+{
+  char *p = rep(pat, "*[", 1);
+  size_t i;
+  for (i = 0; i < n; i++) {  /* U+0100, U+0102, ... (2-byte UTF-8) */
+    int c = 0x100 + 2 * (int) i;
+    *p++ = (char) (0xc0 | c >> 6);
+    *p++ = (char) (0x80 | (c & 63));
+  }
+  strcpy(p, "][!\xc3\xa9]");
+  rep(str, "\xc3\xa9", 4096);
+  return n;
+}
+
+static const struct adversary adversaries[] = {
+  { "*a{16}[!a] vs a{n}", adv_anchor, 0, 1024, 65536, "n", 1.2 },
+  { "*a{n}[!a] vs a{4096}", adv_run, 0, 8, 512, "n", 1.2 },
+  { "(*a){8}*[!a] vs a{n}", adv_stars, 0, 1024, 65536, "n", 1.2 },
+  { "(*\xc3\xa9){8}*[!\xc3\xa9] vs \xc3\xa9{n}", adv_utf8, 0, 1024, 65536, "n", 1.2 },
+  { "(**/a/){4}**/[b] vs (a/){n}", adv_deep, WILD_PATHNAME, 64, 4096, "n", 1.2 },
+  { "(**/a/){n}**/[b] vs (a/){256}", adv_globs, WILD_PATHNAME, 2, 64, "n", 1.2 },
+  { "*[n ranges][!\xc3\xa9] vs \xc3\xa9{4096}", adv_class, 0, 4, 1024, "n", 0.2 },
+};
+
+#define NADVERSARY (sizeof adversaries / sizeof *adversaries)
+
+/** return slope of least-squares line through (log x, log y) */
+static double
+exponent(const double *x, const double *y, size_t n)
+{
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    double lx = log(x[i]), ly = log(y[i] > 0 ? y[i] : 1);
+    sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly;
+  }
+  return n > 1 ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 0;
+}
+
+/** run adversarial case a, print its curve; return false if its
+    steps grow faster than its bound */
+static bool
+adversarial(const struct adversary *a)
+{
+  struct wildmatch_stats st;
+  double x[32], steps[32], ns[32], t, ksteps, ktime;
+  char *pat = xmalloc(8 * a->hi + 64), *str = xmalloc(8 * a->hi + 8192);
+  size_t n, k = 0;
+  unsigned long reps, r;
+  int result;
+
+  printf("\n%s (flags %d)\n", a->name, a->flags);
+  printf("%8s %12s %10s %12s %8s\n", a->size, "steps", "steps/n", "ns/match", "match");
+  for (n = a->lo; n <= a->hi && k < 32; n *= 2, k++) {
+    x[k] = (double) a->gen(pat, str, n);
+    result = wildmatch(pat, str, a->flags);
+    wildmatch_stats(&st, 0);
+    steps[k] = (double) st.steps;
+    reps = 0;
+    t = now();
+    do {  /* repeat until long enough to time */
+      for (r = 0; r < 1 + (reps >> 2); r++)
+        result = wildmatch(pat, str, a->flags);
+      reps += r;
+    } while (now() - t < MINTIME);
+    ns[k] = (now() - t) / reps;
+    printf("%8zu %12.0f %10.2f %12.1f %8s\n", n, steps[k], steps[k] / x[k],
+           ns[k], result ? "yes" : "no");
+  }
+  ksteps = exponent(x, steps, k);
+  ktime = exponent(x, ns, k);
+  printf("exponent: steps %.2f, time %.2f (bound %.1f)%s\n", ksteps, ktime,
+         a->bound, ksteps > a->bound ? "  ** EXCEEDED **" : "");
+  free(pat);
+  free(str);
+  return ksteps <= a->bound;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *me = argv[0];
+  const char *only = 0;
+  size_t i, j, scale = 1;
+  int opt, reps = 5;
+  bool adverse = false, ok = true;
+
+  while ((opt = getopt(argc, argv, "ar:s:")) > 0) {
+    switch (opt) {
+      case 'a': adverse = true; break;
+      case 'r': reps = atoi(optarg); break;
+      case 's': scale = (size_t) atol(optarg); break;
+      default:
+        fprintf(stderr, "Usage: %s [-r reps] [-s scale] [engine]\n"
+                        "       %s -a\n", me, me);
+        return 127;
+    }
+  }
+
+  if (adverse) {
+    if (!wildmatch_stats(0, 0)) {
+      fprintf(stderr, "%s: -a needs wildmatch compiled with WILDMATCH_STATS\n", me);
+      return 127;
+    }
+    for (i = 0; i < NADVERSARY; i++)
+      ok &= adversarial(&adversaries[i]);
+    return ok ? 0 : 1;
+  }
+  if (optind < argc) only = argv[optind];
+  if (reps < 1) reps = 1;
+  if (scale < 1) scale = 1;
+
+  /* so that fnmatch sees characters, not bytes */
+  if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, "en_US.UTF-8"))
+    engines[NENGINE-1].features &= ~F_UTF8;
+
+  fill(&corpora[C_PATHS], 20000 * scale, 200, genpath);
+  fill(&corpora[C_WORDS], 20000 * scale, 30, genword);
+  fill(&corpora[C_LINES], 250 * scale, 4100, genline);
+  fill(&corpora[C_UTF8], 20000 * scale, 40, genutf8);
+  fill(&corpora[C_CJK], 2000 * scale, 520, gencjk);
+
+  printf("%-6s %-22s %-5s %-10s %10s %10s %10s %8s\n", "corpus", "pattern",
+         "flags", "engine", "ns/match", "p99", "Mmatch/s", "hits");
+  for (i = 0; i < NCASE; i++) {
+    int need = needs(cases[i].pat, cases[i].flags, &corpora[cases[i].corpus]);
+    for (j = 0; j < NENGINE; j++) {
+      if ((engines[j].features & need) != need) continue;
+      if (only && strcmp(only, engines[j].name)) continue;
+      run(&engines[j], &cases[i], reps);
+    }
+  }
+
+  return 0;
+}
@@ -1,29 +1,439 @@
+#define _XOPEN_SOURCE 700  /* for getopt, fileno, mmap, writev */
 
-#define _POSIX_C_SOURCE 2L  /* for getopt and fileno */
-
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "wildmatch.h"
 
+/* About filter mode
+ *
+ * With -g (or any of -vclz) the arguments after the pattern are
+ * files (none or "-" for standard input), and their records (lines,
+ * or NUL-terminated with -z) that match are written to standard
+ * output, like grep does.
+ *
+ * Regular files are mapped into memory, anything else is read in
+ * large blocks into one buffer that only grows if a record does not
+ * fit. Records are found with memchr and matched in place against
+ * the compiled pattern; selected records are collected as iovecs
+ * pointing into the input (adjacent ones merged) and written with
+ * writev when the iovecs run out or before the input goes away.
+ * Nothing is allocated or copied per record.
+ *
+ * With -j, large mapped files are cut into chunks of whole records
+ * that are filtered by that many threads. Each chunk collects its
+ * own iovecs (growing as needed), and the main thread writes the
+ * chunks in order as they are done. Chunks are taken from a ring
+ * of slots, so that threads stay at most a few chunks ahead of the
+ * output, and the iovec arrays are reused for later chunks.
+ */
+
+#define OUT_IOV    512         /* at most IOV_MAX */
+#define READSIZE   (1 << 20)
+#define CHUNKSIZE  (4 << 20)
+#define CHUNKSLOTS 4           /* per thread */
+
+struct output {
+  struct iovec *iov;
+  size_t n, max;
+  bool keep;                   /* grow instead of writing when full */
+  bool failed;
+};
+
+struct filter {
+  const struct wildprog *prog;
+  char sep;                    /* record separator: newline or NUL */
+  bool invert, count, list;
+  int nthread;                 /* for large mapped files */
+  size_t chunksize;            /* filtered by each thread at a time */
+  bool nothreads;              /* start none: filter in the caller */
+  size_t nsel;                 /* records selected in current file */
+  char *buf;                   /* read buffer (not for mapped files) */
+  size_t size;
+  struct output out;
+};
+
+struct chunk {
+  struct filter f;             /* copy with own output and count */
+  const char *p, *end;
+  bool done;
+};
+
+struct pfilter {
+  const char *cut, *end;       /* rest of the file, not yet in chunks */
+  size_t next, written;        /* chunks taken, chunks written */
+  struct chunk *slot;          /* chunk k in slot[k % nslot] */
+  size_t nslot;
+  bool stop;                   /* -l has seen enough */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/** write all pending output */
+static void
+outflush(struct output *o)
+{
+  struct iovec *v = o->iov;
+  size_t n = o->n;
+  ssize_t r;
+
+  while (n > 0 && !o->failed) {
+    r = writev(STDOUT_FILENO, v, n < OUT_IOV ? (int) n : OUT_IOV);
+    if (r < 0) {
+      if (errno != EINTR) o->failed = true;
+      continue;
+    }
+    for (; n > 0 && (size_t) r >= v->iov_len; v++, n--)
+      r -= v->iov_len;
+    if (n > 0) {  /* partial write */
+      v->iov_base = (char *) v->iov_base + r;
+      v->iov_len -= r;
+    }
+  }
+  o->n = 0;
+}
+
+/** queue len bytes at p (which must stay valid until flushed) */
+static void
+outbytes(struct output *o, const char *p, size_t len)
+{
+  struct iovec *last = o->n ? &o->iov[o->n-1] : 0;
+  if (last && (const char *) last->iov_base + last->iov_len == p) {
+    last->iov_len += len;  /* adjacent to previous bytes */
+    return;
+  }
+  if (o->n == o->max) {
+    struct iovec *iov;
+    if (!o->keep) {
+      outflush(o);
+    }
+    else if ((iov = realloc(o->iov, 2 * o->max * sizeof *iov))) {
+      o->iov = iov;
+      o->max *= 2;
+    }
+    else {
+      o->failed = true;  /* out of memory */
+      return;
+    }
+  }
+  o->iov[o->n].iov_base = (void *) p;
+  o->iov[o->n].iov_len = len;
+  o->n++;
+}
+
+/** filter the records in p..end, where the last one may only be
+    unterminated at the end of input (eof); return the end of the
+    records done, which is end unless a partial record is left */
+static const char *
+filterbuf(struct filter *f, const char *p, const char *end, bool eof)
+{
+  static const char seps[] = "\n";  /* both separators, with the NUL */
+  const char *q;
+
+  while (p < end) {
+    q = memchr(p, f->sep, end - p);
+    if (!q) {
+      if (!eof) break;
+      q = end;
+    }
+    if ((wildmatch_execn(f->prog, p, q - p) != 0) != f->invert) {
+      f->nsel++;
+      if (f->list) return end;
+      if (!f->count) {
+        outbytes(&f->out, p, q - p + (q < end));
+        if (q == end)  /* unterminated last record */
+          outbytes(&f->out, f->sep ? seps : seps + 1, 1);
+      }
+    }
+    p = q < end ? q + 1 : end;
+  }
+  return p;
+}
+
+/** filter chunks of pf until there are none left */
+static void *
+filterchunks(void *arg)
+{
+  struct pfilter *pf = arg;
+  struct chunk *c;
+  const char *q;
+
+  pthread_mutex_lock(&pf->lock);
+  for (;;) {
+    while (!pf->stop && pf->cut < pf->end && pf->next == pf->written + pf->nslot)
+      pthread_cond_wait(&pf->cond, &pf->lock);
+    if (pf->stop || pf->cut == pf->end) break;
+    c = &pf->slot[pf->next++ % pf->nslot];
+    c->p = pf->cut;
+    c->end = pf->end;
+    if ((size_t) (pf->end - c->p) > c->f.chunksize &&
+        (q = memchr(c->p + c->f.chunksize, c->f.sep,
+                    pf->end - c->p - c->f.chunksize)))
+      c->end = q + 1;
+    c->done = false;
+    pf->cut = c->end;
+    pthread_mutex_unlock(&pf->lock);
+
+    c->f.nsel = 0;
+    c->f.out.n = 0;
+    c->f.out.failed = false;
+    filterbuf(&c->f, c->p, c->end, true);
+
+    pthread_mutex_lock(&pf->lock);
+    c->done = true;
+    if (c->f.list && c->f.nsel) pf->stop = true;
+    pthread_cond_broadcast(&pf->cond);
+  }
+  pthread_mutex_unlock(&pf->lock);
+  return 0;
+}
+
+/** filter records in p..end with f->nthread threads, writing them in
+    order from the calling thread; return false if out of memory */
+static bool
+filterpar(struct filter *f, const char *p, const char *end)
+{
+  struct pfilter pf;
+  struct chunk *c;
+  pthread_t *threads;
+  size_t i, nslot = (size_t) f->nthread * CHUNKSLOTS;
+  int n, nthread = 0;
+  bool ok = true;
+
+  pf.cut = p;
+  pf.end = end;
+  pf.next = pf.written = 0;
+  pf.nslot = nslot;
+  pf.stop = false;
+  pf.slot = calloc(nslot, sizeof *pf.slot);
+  threads = calloc(f->nthread, sizeof *threads);
+  if (!pf.slot || !threads) {
+    ok = false;
+    goto done;
+  }
+  for (i = 0; i < nslot; i++) {
+    c = &pf.slot[i];
+    c->f = *f;
+    c->f.buf = 0;
+    c->f.out.n = 0;
+    c->f.out.max = 64;
+    c->f.out.keep = true;
+    if (!(c->f.out.iov = malloc(c->f.out.max * sizeof *c->f.out.iov))) {
+      ok = false;
+      goto done;
+    }
+  }
+
+  pthread_mutex_init(&pf.lock, 0);
+  pthread_cond_init(&pf.cond, 0);
+  for (n = 0; n < f->nthread && !f->nothreads; n++)
+    if (pthread_create(&threads[n], 0, filterchunks, &pf) == 0)
+      nthread++;
+  if (nthread == 0) {  /* no threads to be had: do it here, in order */
+    filterbuf(f, p, end, true);
+    pf.cut = end;  /* so there are no chunks to write */
+  }
+
+  /* write chunks in order as they are done */
+  pthread_mutex_lock(&pf.lock);
+  for (;;) {
+    c = &pf.slot[pf.written % nslot];
+    while (pf.written < pf.next ? !c->done : !pf.stop && pf.cut < pf.end)
+      pthread_cond_wait(&pf.cond, &pf.lock);
+    if (pf.written == pf.next) break;
+    pthread_mutex_unlock(&pf.lock);
+    if (c->f.out.failed) ok = false;  /* out of memory */
+    if (ok) {
+      c->f.out.failed = f->out.failed;
+      outflush(&c->f.out);
+      f->out.failed = c->f.out.failed;
+      f->nsel += c->f.nsel;
+    }
+    pthread_mutex_lock(&pf.lock);
+    if (!ok) pf.stop = true;
+    pf.written++;
+    pthread_cond_broadcast(&pf.cond);
+  }
+  pthread_mutex_unlock(&pf.lock);
+
+  for (n = 0; n < nthread; n++)
+    pthread_join(threads[n], 0);
+  pthread_cond_destroy(&pf.cond);
+  pthread_mutex_destroy(&pf.lock);
+
+done:
+  for (i = 0; pf.slot && i < nslot; i++)
+    free(pf.slot[i].f.out.iov);
+  free(pf.slot);
+  free(threads);
+  if (!ok) errno = ENOMEM;
+  return ok;
+}
+
+/** filter the records of file fd; return false on read error */
+static bool
+filterfd(struct filter *f, int fd)
+{
+  struct stat st;
+  size_t have = 0;
+  ssize_t r;
+  char *p;
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (off_t) (size_t) st.st_size == st.st_size) {
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      bool ok = true;
+      posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+      if (f->nthread > 1 && (size_t) st.st_size > f->chunksize)
+        ok = filterpar(f, map, (char *) map + st.st_size);
+      else
+        filterbuf(f, map, (char *) map + st.st_size, true);
+      outflush(&f->out);
+      munmap(map, st.st_size);
+      return ok;
+    }
+  }
+
+  for (;;) {
+    if (have == f->size) {  /* record longer than buffer */
+      size_t size = f->size ? 2 * f->size : READSIZE;
+      if (!(p = realloc(f->buf, size))) {
+        errno = ENOMEM;
+        return false;
+      }
+      f->buf = p;
+      f->size = size;
+    }
+    r = read(fd, f->buf + have, f->size - have);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) return false;
+    p = (char *) filterbuf(f, f->buf, f->buf + have + r, r == 0);
+    outflush(&f->out);
+    if (r == 0 || (f->list && f->nsel)) return true;
+    have = f->buf + have + r - p;
+    memmove(f->buf, p, have);
+  }
+}
+
+/** report a count or file name if asked to */
+static void
+filtersummary(struct filter *f, const char *name, bool showname)
+{
+  char num[32];
+  int n;
+  if (f->list && f->nsel) {
+    outbytes(&f->out, name, strlen(name));
+    outbytes(&f->out, "\n", 1);
+  }
+  else if (f->count && !f->list) {
+    if (showname) {
+      outbytes(&f->out, name, strlen(name));
+      outbytes(&f->out, ":", 1);
+    }
+    n = snprintf(num, sizeof num, "%zu\n", f->nsel);
+    outbytes(&f->out, num, n);
+  }
+  outflush(&f->out);
+}
+
+/** filter files (or standard input); return exit status as grep */
+static int
+filter(const char *me, struct filter *f, char **files, int nfile)
+{
+  static char *stdinonly[] = { "-" };
+  const char *name;
+  size_t total = 0;
+  bool failed = false;
+  int i, fd;
+
+  if (nfile == 0) {
+    files = stdinonly;
+    nfile = 1;
+  }
+
+  for (i = 0; i < nfile; i++) {
+    bool isstdin = !strcmp(files[i], "-");
+    name = isstdin ? "(standard input)" : files[i];
+    fd = isstdin ? STDIN_FILENO : open(files[i], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "%s: %s: %s\n", me, name, strerror(errno));
+      failed = true;
+      continue;
+    }
+    f->nsel = 0;
+    if (!filterfd(f, fd)) {
+      fprintf(stderr, "%s: %s: %s\n", me, name, strerror(errno));
+      failed = true;
+    }
+    filtersummary(f, name, nfile > 1);
+    total += f->nsel;
+    if (!isstdin) close(fd);
+  }
+
+  if (f->out.failed) {
+    fprintf(stderr, "%s: write error: %s\n", me, strerror(errno));
+    failed = true;
+  }
+  free(f->buf);
+  free(f->out.iov);
+  return failed ? 2 : total ? 0 : 1;
+}
+
 int
 main(int argc, char *argv[])
 {
   const char *me;
-  const char *pat;
-  int i, opt, flags = 0;
+  const char *pat, *s;
+  struct filter f;
+  struct wildprog *prog;
+  bool filtering = false;
+  int i, opt, r, flags = 0;
+
+  memset(&f, 0, sizeof f);
+  f.sep = '\n';
+  f.nthread = 1;
+  f.chunksize = CHUNKSIZE;
+
+  /* for the tests: small chunks, and the fallback without threads */
+  if ((s = getenv("WILDMATCH_CHUNKSIZE")) && atol(s) > 0)
+    f.chunksize = (size_t) atol(s);
+  f.nothreads = getenv("WILDMATCH_NOTHREADS") != 0;
 
   me = argv[0];
-  while ((opt = getopt(argc, argv, "fFhHpP")) > 0) {
+  while ((opt = getopt(argc, argv, "fFuUsSbBhHpPgvclzj:")) > 0) {
     switch (opt) {
       case 'f': flags |= WILD_CASEFOLD; break;
-      case 'F': flags &= ~WILD_CASEFOLD; break;
+      case 'F': flags &= ~(WILD_CASEFOLD|WILD_UNIFOLD); break;
+      case 'u': flags |= WILD_UNIFOLD; break;
+      case 'U': flags &= ~WILD_UNIFOLD; break;
+      case 's': flags |= WILD_STRICT; break;
+      case 'S': flags &= ~WILD_STRICT; break;
+      case 'b': flags |= WILD_BYTES; break;
+      case 'B': flags &= ~WILD_BYTES; break;
       case 'h': flags |= WILD_PERIOD; break;
       case 'H': flags &= ~WILD_PERIOD; break;
       case 'p': flags |= WILD_PATHNAME; break;
       case 'P': flags &= ~WILD_PATHNAME; break;
+      case 'g': filtering = true; break;
+      case 'v': filtering = f.invert = true; break;
+      case 'c': filtering = f.count = true; break;
+      case 'l': filtering = f.list = true; break;
+      case 'z': filtering = true; f.sep = 0; break;
+      case 'j':
+        f.nthread = atoi(optarg);
+        if (f.nthread <= 0) f.nthread = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (f.nthread <= 0) f.nthread = 1;
+        break;
       default:
         fprintf(stderr, "%s: invalid option: -%c\n", me, optopt);
         return 127;
@@ -33,14 +443,29 @@ main(int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s [-fFhHpP] <pat> <str1> ...\n", me);
+  if (argc < 1 || (argc < 2 && !filtering)) {
+    fprintf(stderr, "Usage: %s [-fFuUsSbBhHpP] <pat> <str1> ...\n"
+                    "       %s -g [-fFuUsSbBhHpPvclz] [-j <threads>] <pat> [<file> ...]\n", me, me);
     return 127;
   }
 
+  pat = argv[0];
+
+  if (filtering) {
+    f.out.max = OUT_IOV;
+    if (!(f.out.iov = malloc(f.out.max * sizeof *f.out.iov)) ||
+        !(prog = wildmatch_compile(pat, flags))) {
+      fprintf(stderr, "%s: out of memory\n", me);
+      return 2;
+    }
+    f.prog = prog;
+    r = filter(me, &f, argv + 1, argc - 1);
+    wildmatch_free(prog);
+    return r;
+  }
+
   printf("Flags: %d\n", flags);
 
-  pat = argv[0];
   for (i = 1; i < argc; i++) {
     const char *str = argv[i];
     bool r = wildmatch(pat, str, flags);
@@ -1,13 +1,16 @@
 /* Unit Tests */
 
-#define _POSIX_C_SOURCE 1 /* for fileno(3) */
-#define _XOPEN_SOURCE 500 /* for snprintf(3) */
+#define _POSIX_C_SOURCE 200809L /* for fileno(3), openat(2) */
+#define _XOPEN_SOURCE 700 /* for snprintf(3), mkdtemp(3), symlink(2) */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "wildmatch.h"
@@ -55,19 +58,30 @@ struct tests {
 };
 
 static void
-tabletests(struct tests *tests)
+tablefail(const char *what, struct tests *test, int r)
 {
   char buf[256];
-  int i;
+  snprintf(buf, sizeof buf,
+    "%s pat=(%s), str=(%s), flags=%d -- r=%d x=%d",
+    what, test->pat, test->str, test->flags, r, test->expected);
+  test_fail(__FILE__, __LINE__, "- %s failed", buf);
+}
+
+static void
+tabletests(struct tests *tests)
+{
+  struct wildprog *prog;
+  int i, r;
   for (i = 0; tests[i].pat; i++) {
-    int r = wildmatch(tests[i].pat, tests[i].str, tests[i].flags);
-    int x = tests[i].expected;
-    if (r != x) {
-      snprintf(buf, sizeof buf,
-        "match pat=(%s), str=(%s), flags=%d -- r=%d x=%d",
-        tests[i].pat, tests[i].str, tests[i].flags, r, x);
-      test_fail(__FILE__, __LINE__, "- %s failed", buf);
-    }
+    r = wildmatch(tests[i].pat, tests[i].str, tests[i].flags);
+    if (r != tests[i].expected)
+      tablefail("match", &tests[i], r);
+    if (!(prog = wildmatch_compile(tests[i].pat, tests[i].flags)))
+      TEST_ABORT("out of memory");
+    r = wildmatch_exec(prog, tests[i].str);
+    if (r != tests[i].expected)
+      tablefail("exec", &tests[i], r);
+    wildmatch_free(prog);
   }
 }
 
@@ -148,6 +162,11 @@ struct tests btests[] = {
   { "a[^0-9]",      "a3",   0, false },
   { "[!^]",         "^",    0, false },
   { "[^!]",         "!",    0, false },
+  { "[a-zA-Z0-9_]*.[ch]", "foo_1.c", 0, true },
+  { "[a-zA-Z0-9_]*.[ch]", "-foo.c",  0, false },
+  { "[z-a]",        "m",    0, false }, /* empty range */
+  { "[a-c-e]",      "d",    0, true  }, /* a-c, then a-e */
+  { "[a-c-e]",      "-",    0, false },
   { 0, 0, 0, 0 }
 };
 
@@ -164,6 +183,14 @@ struct tests ftests[] = {
   { "*X*[yY]?*", "xyz",     0,             false },
   { "*X*[yY]?*", "xyz",     WILD_CASEFOLD, true  },
   { "*X*[yY]?*", "-x-Y-z-", WILD_CASEFOLD, true  },
+  { "[!a-z]",    "Q",       0,             true  },
+  { "[!a-z]",    "Q",       WILD_CASEFOLD, false },
+  { "[!A-Z]",    "q",       WILD_CASEFOLD, false },
+  { "[Z-a]",     "z",       WILD_CASEFOLD, true  }, /* folded Z */
+  { "*a@[",      "xA`{",    WILD_CASEFOLD, false }, /* not letters */
+  { "*Q@[",      "xq@[",    WILD_CASEFOLD, true  },
+  { "[@[]",      "`",       WILD_CASEFOLD, false },
+  { "*ABCDEFGHIJKLMNOPQRSTUVWXYZ", "-abcdefghijklmnopqrstuvwxyz", WILD_CASEFOLD, true },
   { 0, 0, 0, 0 }
 };
 
@@ -354,6 +381,13 @@ struct tests utests[] = {
   { "П*й?*?й", "Пётр Ильи́ч Чайко́вский", 0, true },
   { "*μ*μ?",   "Καλημέρα κόσμε", 0, true },
   { "*[𝄞]*?",  "clef𝄞treble𝄞", 0, true }, /* U+1D11E encodes in 4 bytes */
+  { "[α-ωа-я]", "μ",       0, true  },
+  { "[α-ωа-я]", "ж",       0, true  },
+  { "[α-ωа-я]", "Ж",       0, false },
+  { "[!α-ωа-я]", "ж",      0, false },
+  { "[!α-ωа-я]", "Ж",      0, true  },
+  { "[!α-ω]",   "a",       0, true  },
+  { "[ä-üα-ω]", "ö",       0, true  }, /* range across 255 */
 
   /* The following test cases present invalid UTF-8 encodings
      and the tests are specific to our decoder implementation;
@@ -377,6 +411,954 @@ test_imatch_utf(void)
   tabletests(utests);
 }
 
+void
+test_compile(void)
+{
+  const char *strs[] = { "a.c", "b.h", "dir/x.c", ".c", "a.C", 0 };
+  int expected[] = { 1, 0, 0, 0, 1 };
+  struct wildprog *prog;
+  int i;
+
+  TEST_ASSERT_FALSE(wildmatch_compile(0, 0));
+  TEST_ASSERT_FALSE(wildmatch_exec(0, "x"));
+
+  prog = wildmatch_compile("[a-z]*.c", WILD_CASEFOLD|WILD_PATHNAME|WILD_PERIOD);
+  if (!prog) TEST_ABORT("out of memory");
+  TEST_ASSERT_FALSE(wildmatch_exec(prog, 0));
+  /* compiled once, matched many times */
+  for (i = 0; strs[i]; i++)
+    TEST_ASSERT_TRUE(wildmatch_exec(prog, strs[i]) == expected[i]);
+  wildmatch_free(prog);
+  wildmatch_free(0);
+
+  /* long patterns do not fit the stack buffer of wildmatch() */
+  TEST_ASSERT_TRUE(wildmatch(
+    "[a][b][c][d][e][f][g][h][i][j][k][l][m][n][o][p][q][r][s][t][u][v][w]*"
+    "[a][b][c][d][e][f][g][h][i][j][k][l][m][n][o][p][q][r][s][t][u][v][w]*",
+    "abcdefghijklmnopqrstuvw-abcdefghijklmnopqrstuvw", 0));
+}
+
+void
+test_prefilter(void)
+{
+  /* required literals at start, at end, and in between */
+  TEST_ASSERT_TRUE(wildmatch("*.log", "x.log", 0));
+  TEST_ASSERT_FALSE(wildmatch("*.log", "x.lo", 0));
+  TEST_ASSERT_FALSE(wildmatch("*.log", "log", 0));
+  TEST_ASSERT_FALSE(wildmatch("abc", "ab", 0));
+  TEST_ASSERT_TRUE(wildmatch("ab*ba", "abba", 0));
+  TEST_ASSERT_FALSE(wildmatch("ab*ba", "aba", 0));
+  TEST_ASSERT_TRUE(wildmatch("a*bcd*e", "abcde", 0));
+  TEST_ASSERT_FALSE(wildmatch("a*bcd*e", "abcbde", 0));
+  TEST_ASSERT_FALSE(wildmatch("*abc*", "ab", 0));
+  TEST_ASSERT_TRUE(wildmatch("*abby*zoom*", "xxABBYzOoMx", WILD_CASEFOLD));
+  TEST_ASSERT_FALSE(wildmatch("*abby*zoom*", "xxABBYzOoMx", 0));
+  TEST_ASSERT_TRUE(wildmatch("src/**/*_test.go", "src/a/b_test.go", WILD_PATHNAME));
+  TEST_ASSERT_FALSE(wildmatch("src/**/*_test.go", "src/a/b_test.g", WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatch("*\xc3\xbc*", "x\xc3\xbcx", 0));
+  /* literals that may be cut off by the end of string are not required */
+  TEST_ASSERT_TRUE(wildmatch("foo/**", "foo", WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatch("*foo/**", "xfoo", WILD_PATHNAME));
+}
+
+void
+test_search(void)
+{
+  char str[200];
+  memset(str, 'x', sizeof str);
+  memcpy(str + 150, "abc/de", 6);
+
+  /* the text after a star is searched for, many bytes at a time */
+  TEST_ASSERT_TRUE(wildmatchn("*abc*", 5, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("*ABC*", 5, str, sizeof str, WILD_CASEFOLD));
+  TEST_ASSERT_TRUE(wildmatchn("*a*c/d*x", 8, str, sizeof str, 0));
+  TEST_ASSERT_FALSE(wildmatchn("*a*c/d*y", 8, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("*/d*", 4, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("*/d*", 4, str, sizeof str, WILD_PATHNAME));
+  TEST_ASSERT_FALSE(wildmatchn("*d*", 3, str, sizeof str, WILD_PATHNAME));
+  TEST_ASSERT_FALSE(wildmatchn("*c", 2, str, sizeof str, WILD_PATHNAME));
+  TEST_ASSERT_FALSE(wildmatchn("x*", 2, str, sizeof str, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatchn("x*", 2, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("x*", 2, str, 150, WILD_PATHNAME));
+}
+
+void
+test_ascii(void)
+{
+  char str[100];
+  memset(str, 'a', sizeof str);
+
+  /* ASCII strings are matched without decoding */
+  TEST_ASSERT_TRUE(wildmatchn("*[!a]", 5, str, sizeof str, 0) == 0);
+  TEST_ASSERT_TRUE(wildmatchn("a*\xc3\xa4", 5, str, sizeof str, 0) == 0);
+  memcpy(str + 98, "\xc3\xa4", 2);  /* non-ASCII at the very end */
+  TEST_ASSERT_TRUE(wildmatchn("*[!a]", 5, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("a*\xc3\xa4", 5, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("*?", 2, str, sizeof str, 0));
+  TEST_ASSERT_TRUE(wildmatchn("??", 2, str + 97, 3, 0));
+  TEST_ASSERT_FALSE(wildmatchn("???", 3, str + 97, 3, 0));
+  memcpy(str + 98, "\xc0\x80", 2);  /* overlong NUL is replaced */
+  TEST_ASSERT_TRUE(wildmatchn("*\xef\xbf\xbd", 4, str, sizeof str, 0));
+}
+
+void
+test_batch(void)
+{
+  const char *strs[130];
+  uint64_t bits[3];
+  struct wildprog *prog;
+  size_t i, n;
+
+  for (i = 0; i < 130; i++)
+    strs[i] = i % 3 ? "src/a.c" : i % 5 ? "src/b.h" : 0;
+  prog = wildmatch_compile("**/*.c", WILD_PATHNAME);
+  if (!prog) TEST_ABORT("out of memory");
+  memset(bits, 0xFF, sizeof bits);
+  n = wildmatch_batch(prog, strs, 130, bits);
+  TEST_ASSERT_TRUE(n == 86);
+  for (i = 0; i < 130; i++)
+    TEST_ASSERT_TRUE((bits[i/64] >> i%64 & 1) == (i % 3 != 0));
+  TEST_ASSERT_TRUE(bits[2] >> 2 == 0);  /* unused bits cleared */
+  TEST_ASSERT_TRUE(wildmatch_batch(prog, strs, 0, bits) == 0);
+  TEST_ASSERT_TRUE(wildmatch_batch(0, strs, 130, bits) == 0);
+  wildmatch_free(prog);
+}
+
+void
+test_pool(void)
+{
+  static const char *strs[20000];
+  static uint64_t bits[20000/64+1], want[20000/64+1];
+  struct wildpool *pool;
+  struct wildprog *prog;
+  size_t i, n, m;
+  int t;
+
+  for (i = 0; i < 20000; i++)  /* some take much longer */
+    strs[i] = i % 7 ? "src/lib/a.c" : i % 3 ? "x/y/z/.b.c" : 0;
+  if (!(prog = wildmatch_compile("**/*.c", WILD_PATHNAME|WILD_PERIOD)))
+    TEST_ABORT("out of memory");
+  for (t = 1; t <= 8; t *= 2) {
+    if (!(pool = wildpool_new(t)))
+      TEST_ABORT("out of memory");
+    for (n = 0; n <= 20000; n += n < 1100 ? 547 : 8900) {
+      m = wildmatch_batch(prog, strs, n, want);
+      memset(bits, 0xFF, sizeof bits);
+      TEST_ASSERT_TRUE(wildpool_batch(pool, prog, strs, n, bits) == m);
+      TEST_ASSERT_TRUE(memcmp(bits, want, (n + 63) / 64 * sizeof *bits) == 0);
+    }
+    TEST_ASSERT_TRUE(wildpool_batch(pool, 0, strs, n, bits) == 0);
+    wildpool_free(pool);
+  }
+  wildpool_free(0);
+  wildmatch_free(prog);
+}
+
+struct found {
+  char *paths[64];
+  int n;
+};
+
+static int
+collect(const char *path, void *arg)
+{
+  struct found *f = arg;
+  if (f->n < 64) f->paths[f->n++] = strdup(path);
+  return 0;
+}
+
+static int
+cmpstr(const void *a, const void *b)
+{
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/** return paths found by wildglob (or wildglob_parallel with nthreads
+    threads if positive), sorted and separated by spaces */
+static const char *
+globbedn(const char *root, const char *pat, int flags, int nthreads)
+{
+  static char buf[1024];
+  struct found f;
+  int i, r;
+  f.n = 0;
+  if (nthreads > 0)
+    r = wildglob_parallel(root, pat, flags, nthreads, collect, &f);
+  else
+    r = wildglob(root, pat, flags, collect, &f);
+  if (r != 0)
+    return "(error)";
+  qsort(f.paths, f.n, sizeof *f.paths, cmpstr);
+  for (buf[0] = 0, i = 0; i < f.n; i++) {
+    if (i) strcat(buf, " ");
+    strncat(buf, f.paths[i], sizeof buf - strlen(buf) - 2);
+    free(f.paths[i]);
+  }
+  return buf;
+}
+
+static const char *
+globbed(const char *root, const char *pat, int flags)
+{
+  return globbedn(root, pat, flags, 0);
+}
+
+static int
+stop(const char *path, void *arg)
+{
+  (void) path;
+  return ++*(int *) arg == 2 ? 7 : 0;
+}
+
+static int
+count(const char *path, void *arg)
+{
+  (void) path;
+  ++*(int *) arg;
+  return 0;
+}
+
+void
+test_glob(void)
+{
+  const char *files[] = { "src/a.c", "src/b.h", "src/lib/c.c", "src/.hidden/d.c",
+                          "node_modules/x/y.c", "README", 0 };
+  const char *dirs[] = { "src", "src/lib", "src/.hidden", "node_modules",
+                         "node_modules/x", "docs", 0 };
+  const char *pats[] = { "**", "**/*.c", "*/*", "**/x/**", "src/**/", "?*/[a-c]*",
+                         "*/.*/*", "**/lib/*.c", "src", "**/*/", "link/*", "../*",
+                         "src/../*", "src//*.c", "./src/*", 0 };
+  char root[64] = "/tmp/wildglobXXXXXX", path[128], want[1024], name[201];
+  struct found all;
+  int i, j, k, flags, fds[25];
+  FILE *fp;
+
+  if (!mkdtemp(root)) TEST_ABORT("cannot create %s: %s", root, strerror(errno));
+  for (i = 0; dirs[i]; i++) {
+    snprintf(path, sizeof path, "%s/%s", root, dirs[i]);
+    mkdir(path, 0700);
+  }
+  for (i = 0; files[i]; i++) {
+    snprintf(path, sizeof path, "%s/%s", root, files[i]);
+    if ((fp = fopen(path, "w"))) fclose(fp);
+  }
+  snprintf(path, sizeof path, "%s/link", root);
+  if (symlink("src", path)) TEST_ABORT("cannot create %s: %s", path, strerror(errno));
+
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "src/*.c", 0), "src/a.c"));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "SRC/*.C", WILD_CASEFOLD), "src/a.c"));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "src/*/*", WILD_PERIOD), "src/lib/c.c"));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "src/**", WILD_PERIOD),
+                           "src src/.hidden src/.hidden/d.c src/a.c src/b.h src/lib src/lib/c.c"));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "*/", 0), "docs/ node_modules/ src/"));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "l*", 0), "link"));  /* not followed */
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "nope/*", 0), ""));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "link/*", 0), ""));  /* not followed either */
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "../*", 0), ""));  /* not above root */
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "src/../*", 0), ""));
+  TEST_ASSERT_TRUE(!strcmp(globbed(root, "src//a.c", 0), ""));  /* never found */
+  i = 0;
+  TEST_ASSERT_TRUE(wildglob(root, "**", 0, stop, &i) == 7);
+  TEST_ASSERT_TRUE(wildglob("/nonexistent", "*", 0, collect, &all) == -1);
+
+  /* same as matching every path below root */
+  all.n = 0;
+  for (i = 0; files[i]; i++) all.paths[all.n++] = (char *) files[i];
+  for (i = 0; dirs[i]; i++) all.paths[all.n++] = (char *) dirs[i];
+  all.paths[all.n++] = "link";
+  for (flags = 0; flags < 8; flags++) {
+    for (i = 0; pats[i]; i++) {
+      struct found f;
+      size_t n = strlen(pats[i]);
+      f.n = 0;
+      for (j = 0; j < all.n; j++) {
+        bool isdir = j >= 6 && j < all.n - 1;
+        snprintf(path, sizeof path, "%s%s", all.paths[j],
+                 isdir && pats[i][n-1] == '/' ? "/" : "");
+        if (wildmatch(pats[i], path, flags | WILD_PATHNAME))
+          f.paths[f.n++] = strdup(path);
+      }
+      qsort(f.paths, f.n, sizeof *f.paths, cmpstr);
+      for (want[0] = 0, k = 0; k < f.n; k++) {
+        if (k) strcat(want, " ");
+        strcat(want, f.paths[k]);
+        free(f.paths[k]);
+      }
+      if (strcmp(globbed(root, pats[i], flags), want))
+        TEST_INFO("glob %s (flags %d): %s", pats[i], flags, globbed(root, pats[i], flags));
+      TEST_ASSERT_TRUE(!strcmp(globbed(root, pats[i], flags), want));
+      TEST_ASSERT_TRUE(!strcmp(globbedn(root, pats[i], flags, 1), want));
+      TEST_ASSERT_TRUE(!strcmp(globbedn(root, pats[i], flags, 3), want));
+    }
+  }
+  i = 0;
+  TEST_ASSERT_TRUE(wildglob_parallel(root, "**", 0, 2, stop, &i) == 7);
+  TEST_ASSERT_TRUE(i == 2);  /* not called after it stopped */
+  TEST_ASSERT_TRUE(!strcmp(globbedn(root, "src/*/", 0, 4), "src/.hidden/ src/lib/"));
+  TEST_ASSERT_TRUE(!strcmp(globbedn(root, "nope/**", 0, 4), ""));
+
+  /* deeper than a path can be opened at once */
+  memset(name, 'd', 200);
+  name[200] = 0;
+  fds[0] = open(root, O_RDONLY | O_DIRECTORY);
+  for (k = 1; k < 25; k++) {
+    mkdirat(fds[k-1], name, 0700);
+    if ((fds[k] = openat(fds[k-1], name, O_RDONLY | O_DIRECTORY)) < 0)
+      TEST_ABORT("cannot create deep directories: %s", strerror(errno));
+  }
+  close(openat(fds[24], "leaf", O_WRONLY | O_CREAT, 0600));
+  i = 0;
+  TEST_ASSERT_TRUE(wildglob(root, "**/leaf", 0, count, &i) == 0 && i == 1);
+  i = 0;
+  TEST_ASSERT_TRUE(wildglob_parallel(root, "**/leaf", 0, 3, count, &i) == 0 && i == 1);
+  unlinkat(fds[24], "leaf", 0);
+  for (k = 24; k > 0; k--) {
+    close(fds[k]);
+    unlinkat(fds[k-1], name, AT_REMOVEDIR);
+  }
+  close(fds[0]);
+
+  for (i = 0; files[i]; i++) {
+    snprintf(path, sizeof path, "%s/%s", root, files[i]);
+    unlink(path);
+  }
+  for (i = 0; dirs[i]; i++);
+  while (i-- > 0) {
+    snprintf(path, sizeof path, "%s/%s", root, dirs[i]);
+    rmdir(path);
+  }
+  snprintf(path, sizeof path, "%s/link", root);
+  unlink(path);
+  rmdir(root);
+}
+
+void
+test_shiftand(void)
+{
+  const char *strs[] = { "a/b.c", "a/.b.c", "x/a/b.c", "a/b.c/", "\xc3\xa4/\xe2\x82\xac.c", 0 };
+  int expected[] = { 1, 0, 0, 0, 1 };
+  char pat[100], str[100];
+  struct wildprog *prog;
+  int i;
+
+  /* short patterns are matched bit-parallel */
+  prog = wildmatch_compile("?/?*.[c\xe2\x82\xac]", WILD_PATHNAME|WILD_PERIOD);
+  if (!prog) TEST_ABORT("out of memory");
+  for (i = 0; strs[i]; i++)
+    TEST_ASSERT_TRUE(wildmatch_exec(prog, strs[i]) == expected[i]);
+  wildmatch_free(prog);
+
+  /* long ones are not, with the same result */
+  for (i = 0; i < 70; i++) pat[i] = i % 2 ? '*' : 'a';
+  pat[i] = 0;
+  prog = wildmatch_compile(pat, 0);
+  if (!prog) TEST_ABORT("out of memory");
+  TEST_ASSERT_TRUE(wildmatch_exec(prog, pat + 1) == 0);
+  TEST_ASSERT_TRUE(wildmatch_exec(prog, pat));
+  wildmatch_free(prog);
+
+  /* long strings are searched for the literal after a star */
+  for (i = 0; i < 90; i++) str[i] = "abcq"[i % 4];
+  str[i] = 0;
+  prog = wildmatch_compile("*q?z*", 0);
+  if (!prog) TEST_ABORT("out of memory");
+  TEST_ASSERT_FALSE(wildmatch_exec(prog, str));
+  str[49] = 'z';
+  TEST_ASSERT_TRUE(wildmatch_exec(prog, str));
+  TEST_ASSERT_TRUE(wildmatch_exec(prog, str + 40));
+  wildmatch_free(prog);
+}
+
+void
+test_globstar(void)
+{
+  char pat[200], str[200];
+  int i;
+
+  /* many globstars, deeper than recursion used to go */
+  for (i = 0; i < 30; i++) {
+    memcpy(pat + 5*i, "x/**/", 5);
+    memcpy(str + 4*i, "x/d/", 4);
+  }
+  strcpy(pat + 5*i, "y");
+  strcpy(str + 4*i, "y");
+  TEST_ASSERT_TRUE(wildmatch(pat, str, WILD_PATHNAME));
+  str[4*i] = 'z';
+  TEST_ASSERT_FALSE(wildmatch(pat, str, WILD_PATHNAME));
+
+  /* each globstar tries each directory at most once */
+  for (i = 0; i < 90; i++)
+    memcpy(str + 2*i, "a/", 2);
+  str[2*i-1] = 0;
+  TEST_ASSERT_FALSE(wildmatch("**/a/**/a/**/a/**/a/**/b", str, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatch("**/a/**/a/**/a/**/a/**/a", str, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatch("**/a/**/a/**/a/**/a/**", str, WILD_PATHNAME));
+}
+
+/** check the answer of wildmatch_prefix against all strings made of
+    prefix and up to 4 more chars from a small alphabet */
+static bool
+prefixholds(const char *pat, const char *prefix, int flags, int how)
+{
+  static const char abc[] = "a./";
+  char str[64];
+  size_t len = strlen(prefix);
+  int i, k, n, code, all = 1, some = 0;
+
+  strcpy(str, prefix);
+  for (n = 0; n <= 4; n++) {
+    for (code = 0, k = 1; k <= n; k++) code = code * 3 + 2;  /* 3^n - 1 */
+    for (k = 0; k <= code; k++) {
+      int m = k;
+      for (i = 0; i < n; i++, m /= 3) str[len+i] = abc[m % 3];
+      str[len+n] = 0;
+      if (wildmatch(pat, str, flags)) some = 1; else all = 0;
+    }
+  }
+  if (how == WILD_NO) return !some;
+  if (how == WILD_ALWAYS) return all;
+  return how == WILD_MAYBE;
+}
+
+/* pat, prefix, flags, answer */
+struct tests prefixtests[] = {
+  { "src/**/*.c", "src/", WILD_PATHNAME, WILD_MAYBE },
+  { "src/**/*.c", "src/vendor/", WILD_PATHNAME, WILD_MAYBE },
+  { "src/**/*.c", "lib/", WILD_PATHNAME, WILD_NO },
+  { "src/**", "src/vendor/", WILD_PATHNAME, WILD_ALWAYS },
+  { "src/**", "src/", WILD_PATHNAME, WILD_ALWAYS },
+  { "src/**", "src", WILD_PATHNAME, WILD_MAYBE },
+  { "src/*", "src/a/", WILD_PATHNAME, WILD_NO },
+  { "src/*", "src/a/", 0, WILD_ALWAYS },
+  { "*.c", "", 0, WILD_MAYBE },
+  { "abc", "abcd", 0, WILD_NO },
+  { "ABC", "ab", WILD_CASEFOLD, WILD_MAYBE },
+  { "**", "", WILD_PATHNAME, WILD_ALWAYS },
+  { "**", "", WILD_PATHNAME|WILD_PERIOD, WILD_MAYBE },
+  { "**", ".git/", WILD_PATHNAME|WILD_PERIOD, WILD_NO },
+  { "**", "a/", WILD_PATHNAME|WILD_PERIOD, WILD_ALWAYS },
+  { "*/**", ".git/", WILD_PATHNAME|WILD_PERIOD, WILD_NO },
+  { "*/**", "src/.", WILD_PATHNAME|WILD_PERIOD, WILD_ALWAYS },
+  { "*/**", ".", WILD_PATHNAME|WILD_PERIOD, WILD_MAYBE },  /* "./x" matches */
+  { "*/**", "..", WILD_PATHNAME|WILD_PERIOD, WILD_MAYBE },
+  { "\xc3\xa4", "\xc3", 0, WILD_MAYBE },  /* char cut short */
+  { "\xc3\xa4", "\xc3", WILD_STRICT, WILD_MAYBE },
+  { "\xc3\xb6", "\xc3", 0, WILD_MAYBE },
+  { "a\xc3\xa4", "b\xc3", 0, WILD_NO },
+  { 0, 0, 0, 0 }
+};
+
+void
+test_prefix(void)
+{
+  static const char *pats[] = { "a", "*", "**", "a/**", "**/a", "*/*", "**/.a",
+    "a*/", "**/*a/", "?.*", ".*/**", "[!a]/**", "**/", "a*", "*a*", 0 };
+  static const char *prefixes[] = { "", "a", ".", "..", "a/", "./", "a/.", "a/..",
+    "a.", "a/a", ".a/", "/", 0 };
+  int i, j, how;
+
+  for (i = 0; prefixtests[i].pat; i++) {
+    how = wildmatch_prefix(prefixtests[i].pat, prefixtests[i].str, prefixtests[i].flags);
+    if (how != prefixtests[i].expected)
+      tablefail("prefix", &prefixtests[i], how);
+  }
+
+  /* never rule out a match, never claim one that is not */
+  for (i = 0; pats[i]; i++)
+    for (j = 0; prefixes[j]; j++) {
+      int flags = WILD_PATHNAME|WILD_PERIOD;
+      how = wildmatch_prefix(pats[i], prefixes[j], flags);
+      TEST_ASSERT_TRUE(prefixholds(pats[i], prefixes[j], flags, how));
+      how = wildmatch_prefix(pats[i], prefixes[j], 0);
+      TEST_ASSERT_TRUE(prefixholds(pats[i], prefixes[j], 0, how));
+    }
+}
+
+/** match all rows of a table from exactly sized buffers without NUL */
+static void
+slicetests(struct tests *tests)
+{
+  struct tests *test;
+  for (test = tests; test->pat; test++) {
+    size_t m = strlen(test->pat), n = strlen(test->str);
+    char *pat = malloc(m ? m : 1), *str = malloc(n ? n : 1);
+    int r;
+    if (!pat || !str) TEST_ABORT("out of memory");
+    memcpy(pat, test->pat, m);
+    memcpy(str, test->str, n);
+    r = wildmatchn(pat, m, str, n, test->flags);
+    if (r != test->expected)
+      tablefail("wildmatchn", test, r);
+    free(pat);
+    free(str);
+  }
+}
+
+void
+test_slice(void)
+{
+  const char *buf = "src/main.c\0src/util.h\0docs/.hidden";
+  struct wildprog *prog;
+
+  slicetests(itests);
+  slicetests(btests);
+  slicetests(ftests);
+  slicetests(ptests);
+  slicetests(htests);
+  slicetests(utests);
+
+  /* slices of a larger buffer */
+  TEST_ASSERT_TRUE(wildmatchn("*.c", 3, buf, 10, 0));
+  TEST_ASSERT_FALSE(wildmatchn("*.c", 3, buf, 9, 0));
+  TEST_ASSERT_FALSE(wildmatchn("src/*", 5, buf, 3, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatchn("src/*.cpp", 7, buf, 10, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatchn("**/*.h", 6, buf+11, 10, WILD_PATHNAME));
+  TEST_ASSERT_FALSE(wildmatchn("**/*", 4, buf+22, 12, WILD_PATHNAME|WILD_PERIOD));
+  TEST_ASSERT_TRUE(wildmatchn("**/*", 4, buf+22, 12, WILD_PATHNAME));
+  TEST_ASSERT_TRUE(wildmatchn("[a-]", 2, "[a", 2, 0));  /* no class */
+  TEST_ASSERT_FALSE(wildmatchn("x", 1, "", 0, 0));
+  TEST_ASSERT_TRUE(wildmatchn("", 0, "", 0, 0));
+  /* a NUL byte ends the slice early */
+  TEST_ASSERT_TRUE(wildmatchn("*.c", 3, buf, 100, 0));
+  TEST_ASSERT_FALSE(wildmatchn(0, 0, "", 0, 0));
+
+  prog = wildmatch_compilen("*.h+garbage", 3, 0);
+  if (!prog) TEST_ABORT("out of memory");
+  TEST_ASSERT_FALSE(wildmatch_execn(prog, buf, 10));
+  TEST_ASSERT_TRUE(wildmatch_execn(prog, buf+11, 10));
+  TEST_ASSERT_FALSE(wildmatch_execn(prog, 0, 0));
+  wildmatch_free(prog);
+}
+
+/** match all rows of a table with one set of all its patterns */
+static void
+settests(struct tests *tests)
+{
+  struct wildset *set;
+  int i, j, n, r, *ids;
+
+  for (n = 0; tests[n].pat; n++);
+  if (!(set = wildset_new()) || !(ids = malloc(n * sizeof *ids)))
+    TEST_ABORT("out of memory");
+  for (i = 0; i < n; i++)
+    if (wildset_add(set, tests[i].pat, tests[i].flags) != i)
+      TEST_ABORT("wildset_add failed");
+  for (i = 0; i < n; i++) {
+    int k = wildset_match(set, tests[i].str, ids, n);
+    for (r = 0, j = 0; j < k; j++)
+      if (ids[j] == i) r = 1;
+    if (r != tests[i].expected)
+      tablefail("set", &tests[i], r);
+  }
+  free(ids);
+  wildset_free(set);
+}
+
+/** match all rows of a table with deterministic automata */
+static void
+dfatests(struct tests *tests, size_t maxstate)
+{
+  struct wildprog *prog;
+  struct wilddfa *dfa;
+  int i, r;
+  for (i = 0; tests[i].pat; i++) {
+    if (!(prog = wildmatch_compile(tests[i].pat, tests[i].flags)) ||
+        !(dfa = wilddfa_new(prog, maxstate)))
+      TEST_ABORT("out of memory");
+    r = wilddfa_exec(dfa, tests[i].str);
+    if (r != tests[i].expected)
+      tablefail("dfa", &tests[i], r);
+    r = wilddfa_exec(dfa, tests[i].str);  /* again from the cache */
+    if (r != tests[i].expected)
+      tablefail("dfa cached", &tests[i], r);
+    wilddfa_free(dfa);
+    wildmatch_free(prog);
+  }
+}
+
+void
+test_dfa(void)
+{
+  struct wildprog *prog;
+  struct wilddfa *dfa;
+  char str[5000];
+
+  dfatests(itests, 0);
+  dfatests(btests, 0);
+  dfatests(ftests, 0);
+  dfatests(ptests, 0);
+  dfatests(htests, 0);
+  dfatests(utests, 0);
+  dfatests(itests, 2);  /* cache overflows, falls back */
+  dfatests(utests, 2);
+
+  TEST_ASSERT_FALSE(wilddfa_new(0, 0));
+  TEST_ASSERT_FALSE(wilddfa_exec(0, "x"));
+  wilddfa_free(0);
+
+  /* one pass, where backtracking would take quadratic time */
+  memset(str, 'a', sizeof str);
+  prog = wildmatch_compile("*a*a*a*a*a*a*a*a*a*a*[!a]", 0);
+  if (!prog || !(dfa = wilddfa_new(prog, 0)))
+    TEST_ABORT("out of memory");
+  TEST_ASSERT_FALSE(wilddfa_execn(dfa, str, sizeof str));
+  str[sizeof str - 1] = 'b';
+  TEST_ASSERT_TRUE(wilddfa_execn(dfa, str, sizeof str));
+  TEST_ASSERT_FALSE(wilddfa_execn(dfa, str, sizeof str - 1));
+  TEST_ASSERT_FALSE(wilddfa_exec(dfa, 0));
+  wilddfa_free(dfa);
+  wildmatch_free(prog);
+}
+
+/* patterns of simple shape, matched by the literal text */
+struct tests shapetests[] = {
+  { "Makefile", "Makefile", 0, 1 },
+  { "Makefile", "Makefile.in", 0, 0 },
+  { "Makefile", "makefile", WILD_CASEFOLD, 1 },
+  { "", "", 0, 1 },
+  { "", "x", 0, 0 },
+  { ".git", ".git", WILD_PATHNAME|WILD_PERIOD, 1 },
+  { "build/*", "build/x.o", WILD_PATHNAME, 1 },
+  { "build/*", "build/", WILD_PATHNAME, 1 },
+  { "build/*", "build/x/y.o", WILD_PATHNAME, 0 },
+  { "build/*", "build/x/y.o", 0, 1 },
+  { "build/*", "build/.x", WILD_PATHNAME, 1 },
+  { "build/*", "build/.x", WILD_PATHNAME|WILD_PERIOD, 0 },
+  { "build/*", "build/.x", WILD_PERIOD, 1 },
+  { "build/*", "build/..", WILD_PATHNAME|WILD_PERIOD, 0 },
+  { "*", ".x", WILD_PERIOD, 0 },
+  { "*", "./", WILD_PERIOD, 1 },
+  { "*.o", "x.o", 0, 1 },
+  { "*.o", ".o", 0, 1 },
+  { "*.o", ".o", WILD_PERIOD, 0 },
+  { "*.o", "o", 0, 0 },
+  { "*.o", "d/x.o", 0, 1 },
+  { "*.o", "d/x.o", WILD_PATHNAME, 0 },
+  { "*/x.o", "d/x.o", WILD_PATHNAME, 1 },
+  { "*.O", "X.o", WILD_CASEFOLD, 1 },
+  { "*tmp*", "a.tmp.b", 0, 1 },
+  { "*tmp*", "tmp", 0, 1 },
+  { "*tmp*", "tm", 0, 0 },
+  { "*tmp*", "a/tmp", WILD_PATHNAME, 0 },
+  { "*tmp*", ".tmp", WILD_PERIOD, 0 },
+  { "*.tmp*", ".tmp", WILD_PERIOD, 0 },
+  { "*p/t*", "p/t", WILD_PATHNAME, 1 },
+  { "*p/t*", "xp/tx", WILD_PATHNAME, 1 },
+  { "*p/t*", "a/p/t", WILD_PATHNAME, 0 },
+  { "*TMP*", "a.tmp", WILD_CASEFOLD, 1 },
+  { 0, 0, 0, 0 }
+};
+
+void
+test_shape(void)
+{
+  tabletests(shapetests);
+  dfatests(shapetests, 0);
+}
+
+/* Unicode simple case folding */
+struct tests foldtests[] = {
+  { "É",          "é",       WILD_CASEFOLD, false },
+  { "É",          "é",       WILD_UNIFOLD,  true  },
+  { "abc",        "ABC",     WILD_UNIFOLD,  true  },
+  { "*ÄÖÜ*",      "xäöüx",   WILD_UNIFOLD,  true  },
+  { "k*",         "\u212Ax", WILD_UNIFOLD, true  }, /* Kelvin sign */
+  { "*K",         "x\u212A", WILD_UNIFOLD, true  },
+  { "*K",         "x\u212A", WILD_CASEFOLD, false },
+  { "[a-z]",      "\u212A", WILD_UNIFOLD,  true  },
+  { "[!k]",       "\u212A", WILD_UNIFOLD,  false },
+  { "[!k]",       "K",       WILD_UNIFOLD,  false },
+  { "mass",       "maſs",    WILD_UNIFOLD,  true  },
+  { "σ*",         "ς",       WILD_UNIFOLD,  true  },
+  { "[α-ω]",      "Σ",       WILD_UNIFOLD,  true  },
+  { "[α-ω]",      "Σ",       WILD_CASEFOLD, false },
+  { "ϑ",          "ϴ",       WILD_UNIFOLD,  true  }, /* orbit of four */
+  { "µ",          "Μ",       WILD_UNIFOLD,  true  }, /* micro sign */
+  { "ß",          "ẞ",       WILD_UNIFOLD,  true  },
+  { "ß",          "ss",      WILD_UNIFOLD,  false }, /* not simple */
+  { "[Ā-ſ]",      "s",       WILD_UNIFOLD,  true  },
+  { "[!Ā-ſ]",     "ÿ",       WILD_UNIFOLD,  false }, /* Ÿ is U+0178 */
+  { "Ꭰ",          "ꭰ",       WILD_UNIFOLD,  true  }, /* Cherokee */
+  { "*𐐀*",        "x𐐨x",     WILD_UNIFOLD,  true  }, /* Deseret */
+  { "İ",          "i",       WILD_UNIFOLD,  false },
+  { "*\u1FD3",    "\u0390",  WILD_UNIFOLD,  true  }, /* lowercase, both */
+  { "\u0390",     "\u1FD3",  WILD_UNIFOLD,  true  },
+  { "[\u03B0]",   "\u1FE3",  WILD_UNIFOLD,  true  },
+  { "*\uFB05",    "x\uFB06", WILD_UNIFOLD,  true  }, /* ligatures of s and t */
+  { "\uFB05",     "\uFB06",  WILD_CASEFOLD, false },
+  { 0, 0, 0, 0 }
+};
+
+void
+test_unifold(void)
+{
+  tabletests(foldtests);
+  dfatests(foldtests, 0);
+  settests(foldtests);
+}
+
+/* well-formed UTF-8 only, with STRICT */
+struct tests stricttests[] = {
+  { "*",          "\xc3\xa4",         0,           true  },
+  { "*",          "\xc3\xa4",         WILD_STRICT, true  },
+  { "*",          "\xc3",             0,           true  },
+  { "*",          "\xc3",             WILD_STRICT, false }, /* truncated */
+  { "*",          "\xa4",             WILD_STRICT, false }, /* stray continuation */
+  { "*",          "\xc0\x80",         WILD_STRICT, false }, /* overlong */
+  { "*",          "\xe0\x80\xaf",     WILD_STRICT, false },
+  { "*",          "\xf0\x8f\xbf\xbf", WILD_STRICT, false },
+  { "*",          "\xed\xa0\x80",     WILD_STRICT, false }, /* surrogate */
+  { "*",          "\xed\x9f\xbf",     WILD_STRICT, true  }, /* U+D7FF */
+  { "*",          "\xf4\x8f\xbf\xbf", WILD_STRICT, true  }, /* U+10FFFF */
+  { "*",          "\xf4\x90\x80\x80", WILD_STRICT, false }, /* beyond */
+  { "*",          "\xf5\x80\x80\x80", WILD_STRICT, false },
+  { "?",          "\xf4\x90\x80\x80", 0,           true  }, /* replaced */
+  { "*\xef\xbf\xbd", "a\xf4\x90\x80\x80", 0,     true  },
+  { "a*",         "a\xe4\xb8",        WILD_STRICT, false },
+  { "a*",         "a\xe4\xb8\xad",    WILD_STRICT, true  },
+  { "*.txt",      "\xff.txt",         WILD_STRICT, false },
+  { "*.txt",      "\xff.txt",         0,           true  },
+  { "\xff*",      "\xff",             WILD_STRICT, false }, /* pattern too */
+  { "\xff*",      "\xff",             0,           true  },
+  { "*[\xc0\x80]*", "a",              WILD_STRICT, false },
+  { "\xe4\xb8\xad\xe6\x96\x87/*.?", "\xe4\xb8\xad\xe6\x96\x87/\xe6\x96\x87\xe4\xbb\xb6.c",
+    WILD_STRICT|WILD_PATHNAME, true },
+  { "**/[\xe4\xb8\x80-\xe9\xbf\xbf]*", "src/\xe6\x96\x87",
+    WILD_STRICT|WILD_PATHNAME, true },
+  { "**/[\xe4\xb8\x80-\xe9\xbf\xbf]*", "src/\xe6\x96\x87\x80",
+    WILD_STRICT|WILD_PATHNAME, false },
+  { "*\xe6\x96\x87*\xe4\xbb\xb6", "\xe4\xb8\xad\xe6\x96\x87\xe4\xbb\xb6", WILD_STRICT, true },
+  { 0, 0, 0, 0 }
+};
+
+void
+test_strict(void)
+{
+  char str[200];
+  int i;
+
+  tabletests(stricttests);
+  dfatests(stricttests, 0);
+  settests(stricttests);
+
+  /* ill-formed bytes are found anywhere in long strings */
+  memset(str, 'a', sizeof str);
+  memcpy(str + 197, "\xe4\xb8\xad", 3);  /* well-formed */
+  for (i = 0; i < 197; i += 7) {
+    str[i] = (char) 0x80;
+    TEST_ASSERT_FALSE(wildmatchn("a*", 2, str, sizeof str, WILD_STRICT));
+    TEST_ASSERT_TRUE(wildmatchn("a*", 2, str, sizeof str, 0) == (i != 0));
+    str[i] = 'a';
+    TEST_ASSERT_TRUE(wildmatchn("a*", 2, str, sizeof str, WILD_STRICT));
+  }
+
+  /* no ill-formed string goes on from an ill-formed prefix */
+  TEST_ASSERT_TRUE(wildmatch_prefix("**", "a\xff/", WILD_STRICT) == WILD_NO);
+  TEST_ASSERT_TRUE(wildmatch_prefix("**", "a\xe4\xb8", WILD_STRICT) == WILD_MAYBE);
+  TEST_ASSERT_TRUE(wildmatch_prefix("**", "a\xe4\xb8", 0) == WILD_ALWAYS);
+  TEST_ASSERT_TRUE(wildmatch_prefix("\xff**", "", WILD_STRICT) == WILD_NO);
+}
+
+/* bytes, not UTF-8, with BYTES */
+struct tests bytetests[] = {
+  { "?",            "\xc3\xa4",       0,                        true  },
+  { "?",            "\xc3\xa4",       WILD_BYTES,               false },
+  { "??",           "\xc3\xa4",       WILD_BYTES,               true  },
+  { "*\xa4",        "\xc3\xa4",       0,                        false },
+  { "*\xa4",        "\xc3\xa4",       WILD_BYTES,               true  },
+  { "[\xc3\xa4]?",   "\xa4\xc3",       WILD_BYTES,               true  },
+  { "\xe9t\xe9",     "\xe9t\xe9",       WILD_BYTES,               true  }, /* Latin-1 */
+  { "caf\xe9*",     "caf\xe9s",        WILD_BYTES,               true  },
+  { "*\xe9",        "caf\xe9",         WILD_BYTES,               true  },
+  { "*\xe9t*",      "x\xe9t\xe9",      WILD_BYTES,               true  },
+  { "*\xe9?\xe9",    "x\xe9t\xe9",      WILD_BYTES,               true  },
+  { "*[\x80-\xff]*", "abc\xff",         WILD_BYTES,               true  },
+  { "*[\x80-\xff]*", "abc",             WILD_BYTES,               false },
+  { "[!a]",         "\xff",            WILD_BYTES,               true  },
+  { "[!\xff]",      "\xff",            WILD_BYTES,               false },
+  { "\xc9",         "\xe9",            WILD_BYTES|WILD_CASEFOLD, false }, /* ASCII only */
+  { "A*",           "a\xe9",           WILD_BYTES|WILD_CASEFOLD, true  },
+  { "\xc3\x89",     "\xc3\xa9",        WILD_BYTES|WILD_UNIFOLD,  false },
+  { "abc",          "ABC",             WILD_BYTES|WILD_UNIFOLD,  true  },
+  { "*",            "\xff",            WILD_BYTES|WILD_STRICT,   true  },
+  { "*/\xe9*",      "d\xff/\xe9x",      WILD_BYTES|WILD_PATHNAME, true  },
+  { "*/\xe9*",      "d\xff/\xe9x/y",    WILD_BYTES|WILD_PATHNAME, false },
+  { "**/\xe9",      "a/\xfe/\xe9",      WILD_BYTES|WILD_PATHNAME, true  },
+  { 0, 0, 0, 0 }
+};
+
+void
+test_bytes(void)
+{
+  struct wildset *set;
+  int ids[2];
+
+  tabletests(bytetests);
+  dfatests(bytetests, 0);
+  settests(bytetests);
+
+  /* a set of byte patterns only is run over bytes */
+  if (!(set = wildset_new())) TEST_ABORT("out of memory");
+  wildset_add(set, "?", WILD_BYTES);
+  wildset_add(set, "*\xa4", WILD_BYTES);
+  TEST_ASSERT_TRUE(wildset_match(set, "\xc3\xa4", ids, 2) == 1 && ids[0] == 1);
+  TEST_ASSERT_TRUE(wildset_matchany(set, "\xa4"));
+  wildset_free(set);
+
+  TEST_ASSERT_TRUE(wildmatch_prefix("\xe9*/**", "\xe9t\xe9/", WILD_BYTES|WILD_PATHNAME) == WILD_ALWAYS);
+  TEST_ASSERT_TRUE(wildmatch_prefix("\xe9?/**", "\xe9t\xe9/", WILD_BYTES|WILD_PATHNAME) == WILD_NO);
+  TEST_ASSERT_TRUE(wildmatch_prefix("*", "\xff", WILD_BYTES|WILD_STRICT) == WILD_ALWAYS);
+}
+
+void
+test_stats(void)
+{
+  struct wildmatch_stats last, total;
+
+  memset(&last, 0xFF, sizeof last);
+  if (!wildmatch_stats(&last, 0)) {  /* compiled out */
+    TEST_ASSERT_TRUE(last.calls == 0 && last.steps == 0);
+    return;
+  }
+
+  wildmatch_stats_reset();
+  TEST_ASSERT_FALSE(wildmatch("*a?b", "xaxaxcb", 0));
+  wildmatch_stats(&last, 0);
+  TEST_ASSERT_TRUE(last.calls == 1 && last.steps > 0 && last.backtracks > 0);
+  TEST_ASSERT_TRUE(last.classes == 0 && last.globstars == 0);
+
+  TEST_ASSERT_TRUE(wildmatch("[a-c]x", "bx", 0));
+  wildmatch_stats(&last, 0);
+  TEST_ASSERT_TRUE(last.classes == 1 && last.backtracks == 0);
+
+  TEST_ASSERT_TRUE(wildmatch("ä?", "äö", 0));
+  wildmatch_stats(&last, 0);
+  TEST_ASSERT_TRUE(last.decoded == 2);  /* not the pattern's */
+
+  TEST_ASSERT_FALSE(wildmatch("**/a/**/b*", "x/a/y/a/z/c", WILD_PATHNAME));
+  wildmatch_stats(&last, &total);
+  TEST_ASSERT_TRUE(last.globstars > 2 && last.maxdepth == 2 && last.memohits > 0);
+  TEST_ASSERT_TRUE(total.calls == 4 && total.maxdepth == 2);
+  TEST_ASSERT_TRUE(total.steps > last.steps && total.classes == 1);
+
+  wildmatch_stats_reset();
+  wildmatch_stats(&last, &total);
+  TEST_ASSERT_TRUE(last.calls == 0 && total.calls == 0 && total.steps == 0);
+}
+
+/** run ./wildmatch with args (ending with a null) and environment
+    env (or the inherited one if null), its output (and errors) to file
+    out; return its exit status, or -1 if it did not exit */
+static int
+runcli(char *args[], const char *out, char *env[])
+{
+  pid_t pid;
+  int status, fd;
+
+  if ((pid = fork()) < 0) return -1;
+  if (pid == 0) {
+    if ((fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        dup2(fd, 1) < 0 || dup2(fd, 2) < 0)
+      _exit(126);
+    alarm(30);  /* fail rather than hang */
+    if (env)
+      execve("./wildmatch", args, env);
+    else
+      execv("./wildmatch", args);
+    _exit(126);
+  }
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) return -1;
+  return WEXITSTATUS(status);
+}
+
+/** return whether files a and b have the same contents */
+static bool
+samefile(const char *a, const char *b)
+{
+  FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+  bool same = fa && fb;
+  int c;
+  while (same && (c = getc(fa)) == getc(fb) && c != EOF);
+  same = same && c == EOF;
+  if (fa) fclose(fa);
+  if (fb) fclose(fb);
+  return same;
+}
+
+void
+test_filter(void)
+{
+  const char *tmp = getenv("TMPDIR");
+  char in[256], one[260], par[260];
+  char *args[] = { "wildmatch", "-g", "-j", "1", "x*", in, 0 };
+  char *usage[] = { "wildmatch", "x*", 0 };
+  char *chunked[] = { "WILDMATCH_CHUNKSIZE=4096", 0 };
+  char *unthreaded[] = { "WILDMATCH_CHUNKSIZE=4096", "WILDMATCH_NOTHREADS=1", 0 };
+  FILE *fp;
+  long i;
+  int fd;
+
+  if (access("./wildmatch", X_OK))
+    TEST_ABORT("cannot run ./wildmatch: %s", strerror(errno));
+  snprintf(in, sizeof in, "%s/wildfilterXXXXXX", tmp && *tmp ? tmp : "/tmp");
+  if ((fd = mkstemp(in)) < 0 || !(fp = fdopen(fd, "w")))
+    TEST_ABORT("cannot create %s: %s", in, strerror(errno));
+  for (i = 0; i < 20000; i++)  /* 4 KiB chunks: more than 2 threads' slots */
+    fprintf(fp, "%s line %ld\n", i % 10 ? "abc" : "xyz", i);
+  fclose(fp);
+  snprintf(one, sizeof one, "%s.1", in);
+  snprintf(par, sizeof par, "%s.2", in);
+
+  TEST_ASSERT_TRUE(runcli(args, one, 0) == 0);
+  args[3] = "2";
+  TEST_ASSERT_TRUE(runcli(args, par, chunked) == 0);
+  TEST_ASSERT_TRUE(samefile(one, par));
+
+  /* without threads to be had, the same, filtered in the main thread */
+  TEST_ASSERT_TRUE(runcli(args, par, unthreaded) == 0);
+  TEST_ASSERT_TRUE(samefile(one, par));
+
+  /* a pattern alone is not enough to match, and filters only with -g */
+  TEST_ASSERT_TRUE(runcli(usage, one, 0) == 127);
+
+  unlink(one);
+  unlink(par);
+  unlink(in);
+}
+
+void
+test_set(void)
+{
+  struct wildset *set;
+  int ids[4];
+
+  settests(itests);
+  settests(btests);
+  settests(ftests);
+  settests(ptests);
+  settests(htests);
+  settests(utests);
+
+  if (!(set = wildset_new()))
+    TEST_ABORT("out of memory");
+  TEST_ASSERT_TRUE(wildset_match(set, "foo", ids, 4) == 0);
+  TEST_ASSERT_FALSE(wildset_matchany(set, "foo"));
+  TEST_ASSERT_TRUE(wildset_add(set, "*.c", WILD_PATHNAME) == 0);
+  TEST_ASSERT_TRUE(wildset_add(set, "src/**", WILD_PATHNAME) == 1);
+  TEST_ASSERT_TRUE(wildset_add(set, "**/*.C", WILD_PATHNAME|WILD_CASEFOLD) == 2);
+  TEST_ASSERT_TRUE(wildset_add(set, "*", 0) == 3);
+  TEST_ASSERT_TRUE(wildset_add(set, 0, 0) == -1);
+
+  TEST_ASSERT_TRUE(wildset_match(set, "src/a.c", ids, 4) == 3);
+  TEST_ASSERT_TRUE(ids[0] == 1 && ids[1] == 2 && ids[2] == 3);
+  TEST_ASSERT_TRUE(wildset_match(set, "a.c", ids, 1) == 3);
+  TEST_ASSERT_TRUE(ids[0] == 0);  /* only as many ids as asked for */
+  TEST_ASSERT_TRUE(wildset_matchany(set, "lib/a.h"));
+  TEST_ASSERT_FALSE(wildset_match(set, 0, ids, 4));
+  wildset_free(set);
+  wildset_free(0);
+}
+
 static void
 countlines(const char *pat, const char *file, long *pm, long *pn)
 {
@@ -410,9 +1392,8 @@ wholefile(const char *pat, const char *file)
     free(str);
     TEST_ABORT("cannot open %s: %s", file, strerror(errno));
   }
-  n = fread(str, 1, n-1, fp);
-  str[n] = '\0';
-  r = wildmatch(pat, str, WILD_CASEFOLD);
+  n = fread(str, 1, n, fp);  /* no need for a terminating NUL */
+  r = wildmatchn(pat, strlen(pat), str, n, WILD_CASEFOLD);
   fclose(fp);
   free(str);
   return r;
@@ -453,6 +1434,27 @@ main(void)
   TEST_RUN(test_imatch_pathname);
   TEST_RUN(test_imatch_period);
   TEST_RUN(test_imatch_utf);
+  TEST_RUN(test_compile);
+  TEST_RUN(test_slice);
+  TEST_RUN(test_prefilter);
+  TEST_RUN(test_search);
+  TEST_RUN(test_ascii);
+  TEST_RUN(test_batch);
+  TEST_RUN(test_pool);
+  TEST_RUN(test_shiftand);
+  TEST_RUN(test_glob);
+  TEST_RUN(test_globstar);
+  TEST_RUN(test_prefix);
+  TEST_RUN(test_set);
+  TEST_RUN(test_dfa);
+  TEST_RUN(test_shape);
+  TEST_RUN(test_unifold);
+  TEST_RUN(test_strict);
+  TEST_RUN(test_bytes);
+  TEST_RUN(test_stats);
+
+  TEST_HEADING("Testing the command line");
+  TEST_RUN(test_filter);
 
   TEST_HEADING("Wildmatch performance");
   TEST_RUN(test_imatch_perf);
@@ -0,0 +1,987 @@
+/* Unicode simple case folding, generated by unifold.py from
+ * CaseFolding-15.0.0.txt: do not edit. */
+
+#define FOLD_SHIFT 6
+#define NFOLDORBIT 1427
+
+/* orbit of c < 1958 << FOLD_SHIFT (0 for none):
+   foldblock[foldindex[c >> FOLD_SHIFT]][c & ((1 << FOLD_SHIFT) - 1)] */
+static const unsigned char foldindex[1958] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 0, 11, 12, 13, 14, 15, 16, 17, 18,
+  19, 20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 21, 22, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 23, 24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 25, 0, 0,
+  26, 27, 0, 28, 29, 30, 31, 32, 33, 34, 35, 0, 0, 0, 0, 36, 37, 38, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 39, 40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 41, 42, 43, 44, 45, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 46, 47, 0, 48, 49, 50, 51, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 52,
+  53, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 54, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 55,
+  56, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 57, 58, 59, 60,
+  0, 61, 62, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 63, 63, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 64, 65, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 66, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  67, 68,
+};
+
+static const unsigned short foldblock[69][64] = {
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+    20, 21, 22, 23, 24, 25, 26, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8,
+    9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+    0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 27, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45,
+    46, 47, 48, 49, 50, 0, 51, 52, 53, 54, 55, 56, 57, 58, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49,
+    50, 0, 51, 52, 53, 54, 55, 56, 57, 59,
+  },
+  {
+    60, 60, 61, 61, 62, 62, 63, 63, 64, 64, 65, 65, 66, 66, 67, 67, 68, 68,
+    69, 69, 70, 70, 71, 71, 72, 72, 73, 73, 74, 74, 75, 75, 76, 76, 77, 77,
+    78, 78, 79, 79, 80, 80, 81, 81, 82, 82, 83, 83, 0, 0, 84, 84, 85, 85,
+    86, 86, 0, 87, 87, 88, 88, 89, 89, 90,
+  },
+  {
+    90, 91, 91, 92, 92, 93, 93, 94, 94, 0, 95, 95, 96, 96, 97, 97, 98, 98,
+    99, 99, 100, 100, 101, 101, 102, 102, 103, 103, 104, 104, 105, 105,
+    106, 106, 107, 107, 108, 108, 109, 109, 110, 110, 111, 111, 112, 112,
+    113, 113, 114, 114, 115, 115, 116, 116, 117, 117, 59, 118, 118, 119,
+    119, 120, 120, 19,
+  },
+  {
+    121, 122, 123, 123, 124, 124, 125, 126, 126, 127, 128, 129, 129, 0,
+    130, 131, 132, 133, 133, 134, 135, 136, 137, 138, 139, 139, 140, 0,
+    141, 142, 143, 144, 145, 145, 146, 146, 147, 147, 148, 149, 149, 150,
+    0, 0, 151, 151, 152, 153, 153, 154, 155, 156, 156, 157, 157, 158, 159,
+    159, 0, 0, 160, 160, 0, 161,
+  },
+  {
+    0, 0, 0, 0, 162, 162, 162, 163, 163, 163, 164, 164, 164, 165, 165, 166,
+    166, 167, 167, 168, 168, 169, 169, 170, 170, 171, 171, 172, 172, 130,
+    173, 173, 174, 174, 175, 175, 176, 176, 177, 177, 178, 178, 179, 179,
+    180, 180, 181, 181, 0, 182, 182, 182, 183, 183, 136, 161, 184, 184,
+    185, 185, 186, 186, 187, 187,
+  },
+  {
+    188, 188, 189, 189, 190, 190, 191, 191, 192, 192, 193, 193, 194, 194,
+    195, 195, 196, 196, 197, 197, 198, 198, 199, 199, 200, 200, 201, 201,
+    202, 202, 203, 203, 143, 0, 204, 204, 205, 205, 206, 206, 207, 207,
+    208, 208, 209, 209, 210, 210, 211, 211, 212, 212, 0, 0, 0, 0, 0, 0,
+    213, 214, 214, 140, 215, 216,
+  },
+  {
+    217, 218, 218, 121, 219, 220, 221, 221, 222, 222, 223, 223, 224, 224,
+    225, 225, 226, 227, 228, 122, 125, 0, 127, 128, 0, 131, 0, 132, 229, 0,
+    0, 0, 134, 230, 0, 135, 0, 231, 232, 0, 138, 137, 233, 234, 235, 0, 0,
+    141, 0, 236, 142, 0, 0, 144, 0, 0, 0, 0, 0, 0, 0, 237, 0, 0,
+  },
+  {
+    148, 0, 238, 150, 0, 0, 0, 239, 152, 219, 154, 155, 220, 0, 0, 0, 0, 0,
+    158, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 240, 241, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 242, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 243, 243, 244, 244, 0, 0, 245, 245, 0, 0, 0, 246, 247, 248, 0, 249,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 250, 0, 251, 252, 253, 0, 254, 0, 255, 256, 257, 258,
+    259, 260, 261, 262, 263, 264, 265, 242, 266, 267, 27, 268, 269, 270,
+    271, 272, 0, 273, 274, 275, 276, 277, 278, 279, 280, 281, 250, 251,
+    252, 253, 282, 258, 259, 260, 261, 262, 263, 264, 265, 242, 266, 267,
+    27, 268, 269, 270,
+  },
+  {
+    271, 272, 273, 273, 274, 275, 276, 277, 278, 279, 280, 281, 254, 255,
+    256, 283, 259, 265, 0, 0, 0, 276, 271, 283, 284, 284, 285, 285, 286,
+    286, 287, 287, 288, 288, 289, 289, 290, 290, 291, 291, 292, 292, 293,
+    293, 294, 294, 295, 295, 266, 272, 296, 249, 265, 262, 0, 297, 297,
+    296, 298, 298, 0, 246, 247, 248,
+  },
+  {
+    299, 300, 301, 302, 303, 304, 305, 306, 307, 308, 309, 310, 311, 312,
+    313, 314, 315, 316, 317, 318, 319, 320, 321, 322, 323, 324, 325, 326,
+    327, 328, 329, 330, 331, 332, 333, 334, 335, 336, 337, 338, 339, 340,
+    341, 342, 343, 344, 345, 346, 315, 316, 317, 318, 319, 320, 321, 322,
+    323, 324, 325, 326, 327, 328, 329, 330,
+  },
+  {
+    331, 332, 333, 334, 335, 336, 337, 338, 339, 340, 341, 342, 343, 344,
+    345, 346, 299, 300, 301, 302, 303, 304, 305, 306, 307, 308, 309, 310,
+    311, 312, 313, 314, 347, 347, 348, 348, 349, 349, 350, 350, 351, 351,
+    352, 352, 353, 353, 354, 354, 355, 355, 356, 356, 357, 357, 358, 358,
+    359, 359, 360, 360, 361, 361, 362, 362,
+  },
+  {
+    363, 363, 0, 0, 0, 0, 0, 0, 0, 0, 364, 364, 365, 365, 366, 366, 367,
+    367, 368, 368, 369, 369, 370, 370, 371, 371, 372, 372, 373, 373, 374,
+    374, 375, 375, 376, 376, 377, 377, 378, 378, 379, 379, 380, 380, 381,
+    381, 382, 382, 383, 383, 384, 384, 385, 385, 386, 386, 387, 387, 388,
+    388, 389, 389, 390, 390,
+  },
+  {
+    391, 392, 392, 393, 393, 394, 394, 395, 395, 396, 396, 397, 397, 398,
+    398, 391, 399, 399, 400, 400, 401, 401, 402, 402, 403, 403, 404, 404,
+    405, 405, 406, 406, 407, 407, 408, 408, 409, 409, 410, 410, 411, 411,
+    412, 412, 413, 413, 414, 414, 415, 415, 416, 416, 417, 417, 418, 418,
+    419, 419, 420, 420, 421, 421, 422, 422,
+  },
+  {
+    423, 423, 424, 424, 425, 425, 426, 426, 427, 427, 428, 428, 429, 429,
+    430, 430, 431, 431, 432, 432, 433, 433, 434, 434, 435, 435, 436, 436,
+    437, 437, 438, 438, 439, 439, 440, 440, 441, 441, 442, 442, 443, 443,
+    444, 444, 445, 445, 446, 446, 0, 447, 448, 449, 450, 451, 452, 453,
+    454, 455, 456, 457, 458, 459, 460, 461,
+  },
+  {
+    462, 463, 464, 465, 466, 467, 468, 469, 470, 471, 472, 473, 474, 475,
+    476, 477, 478, 479, 480, 481, 482, 483, 484, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 447, 448, 449, 450, 451, 452, 453, 454, 455, 456, 457, 458, 459,
+    460, 461, 462, 463, 464, 465, 466, 467, 468, 469, 470, 471, 472, 473,
+    474, 475, 476, 477,
+  },
+  {
+    478, 479, 480, 481, 482, 483, 484, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 485, 486, 487, 488, 489, 490, 491, 492, 493,
+    494, 495, 496, 497, 498, 499, 500, 501, 502, 503, 504, 505, 506, 507,
+    508, 509, 510, 511, 512, 513, 514, 515, 516,
+  },
+  {
+    517, 518, 519, 520, 521, 522, 0, 523, 0, 0, 0, 0, 0, 524, 0, 0, 525,
+    526, 527, 528, 529, 530, 531, 532, 533, 534, 535, 536, 537, 538, 539,
+    540, 541, 542, 543, 544, 545, 546, 547, 548, 549, 550, 551, 552, 553,
+    554, 555, 556, 557, 558, 559, 560, 561, 562, 563, 564, 565, 566, 567,
+    0, 0, 568, 569, 570,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 571, 572, 573, 574, 575, 576, 577, 578, 579,
+    580, 581, 582, 583, 584, 585, 586, 587, 588, 589, 590, 591, 592, 593,
+    594, 595, 596, 597, 598, 599, 600, 601, 602,
+  },
+  {
+    603, 604, 605, 606, 607, 608, 609, 610, 611, 612, 613, 614, 615, 616,
+    617, 618, 619, 620, 621, 622, 623, 624, 625, 626, 627, 628, 629, 630,
+    631, 632, 633, 634, 635, 636, 637, 638, 639, 640, 641, 642, 643, 644,
+    645, 646, 647, 648, 649, 650, 651, 652, 653, 654, 655, 656, 0, 0, 651,
+    652, 653, 654, 655, 656, 0, 0,
+  },
+  {
+    317, 319, 329, 332, 333, 333, 341, 348, 657, 0, 0, 0, 0, 0, 0, 0, 525,
+    526, 527, 528, 529, 530, 531, 532, 533, 534, 535, 536, 537, 538, 539,
+    540, 541, 542, 543, 544, 545, 546, 547, 548, 549, 550, 551, 552, 553,
+    554, 555, 556, 557, 558, 559, 560, 561, 562, 563, 564, 565, 566, 567,
+    0, 0, 568, 569, 570,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 658, 0, 0, 0, 659, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 660, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    661, 661, 662, 662, 663, 663, 664, 664, 665, 665, 666, 666, 667, 667,
+    668, 668, 669, 669, 670, 670, 671, 671, 672, 672, 673, 673, 674, 674,
+    675, 675, 676, 676, 677, 677, 678, 678, 679, 679, 680, 680, 681, 681,
+    682, 682, 683, 683, 684, 684, 685, 685, 686, 686, 687, 687, 688, 688,
+    689, 689, 690, 690, 691, 691, 692, 692,
+  },
+  {
+    693, 693, 694, 694, 695, 695, 696, 696, 697, 697, 698, 698, 699, 699,
+    700, 700, 701, 701, 702, 702, 703, 703, 704, 704, 705, 705, 706, 706,
+    707, 707, 708, 708, 709, 709, 710, 710, 711, 711, 712, 712, 713, 713,
+    714, 714, 715, 715, 716, 716, 717, 717, 718, 718, 719, 719, 720, 720,
+    721, 721, 722, 722, 723, 723, 724, 724,
+  },
+  {
+    725, 725, 726, 726, 727, 727, 728, 728, 729, 729, 730, 730, 731, 731,
+    732, 732, 733, 733, 734, 734, 735, 735, 0, 0, 0, 0, 0, 709, 0, 0, 58,
+    0, 736, 736, 737, 737, 738, 738, 739, 739, 740, 740, 741, 741, 742,
+    742, 743, 743, 744, 744, 745, 745, 746, 746, 747, 747, 748, 748, 749,
+    749, 750, 750, 751, 751,
+  },
+  {
+    752, 752, 753, 753, 754, 754, 755, 755, 756, 756, 757, 757, 758, 758,
+    759, 759, 760, 760, 761, 761, 762, 762, 763, 763, 764, 764, 765, 765,
+    766, 766, 767, 767, 768, 768, 769, 769, 770, 770, 771, 771, 772, 772,
+    773, 773, 774, 774, 775, 775, 776, 776, 777, 777, 778, 778, 779, 779,
+    780, 780, 781, 781, 782, 782, 783, 783,
+  },
+  {
+    784, 785, 786, 787, 788, 789, 790, 791, 784, 785, 786, 787, 788, 789,
+    790, 791, 792, 793, 794, 795, 796, 797, 0, 0, 792, 793, 794, 795, 796,
+    797, 0, 0, 798, 799, 800, 801, 802, 803, 804, 805, 798, 799, 800, 801,
+    802, 803, 804, 805, 806, 807, 808, 809, 810, 811, 812, 813, 806, 807,
+    808, 809, 810, 811, 812, 813,
+  },
+  {
+    814, 815, 816, 817, 818, 819, 0, 0, 814, 815, 816, 817, 818, 819, 0, 0,
+    0, 820, 0, 821, 0, 822, 0, 823, 0, 820, 0, 821, 0, 822, 0, 823, 824,
+    825, 826, 827, 828, 829, 830, 831, 824, 825, 826, 827, 828, 829, 830,
+    831, 832, 833, 834, 835, 836, 837, 838, 839, 840, 841, 842, 843, 844,
+    845, 0, 0,
+  },
+  {
+    846, 847, 848, 849, 850, 851, 852, 853, 846, 847, 848, 849, 850, 851,
+    852, 853, 854, 855, 856, 857, 858, 859, 860, 861, 854, 855, 856, 857,
+    858, 859, 860, 861, 862, 863, 864, 865, 866, 867, 868, 869, 862, 863,
+    864, 865, 866, 867, 868, 869, 870, 871, 0, 872, 0, 0, 0, 0, 870, 871,
+    832, 833, 872, 0, 242, 0,
+  },
+  {
+    0, 0, 0, 873, 0, 0, 0, 0, 834, 835, 836, 837, 873, 0, 0, 0, 874, 875,
+    0, 257, 0, 0, 0, 0, 874, 875, 838, 839, 0, 0, 0, 0, 876, 877, 0, 282,
+    0, 878, 0, 0, 876, 877, 842, 843, 878, 0, 0, 0, 0, 0, 0, 879, 0, 0, 0,
+    0, 840, 841, 844, 845, 879, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 279, 0, 0, 0, 11, 33, 0, 0,
+    0, 0, 0, 0, 880, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 880, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 881, 882, 883, 884, 885, 886, 887, 888, 889,
+    890, 891, 892, 893, 894, 895, 896, 881, 882, 883, 884, 885, 886, 887,
+    888, 889, 890, 891, 892, 893, 894, 895, 896,
+  },
+  {
+    0, 0, 0, 897, 897, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 898, 899, 900, 901, 902, 903, 904, 905, 906, 907,
+  },
+  {
+    908, 909, 910, 911, 912, 913, 914, 915, 916, 917, 918, 919, 920, 921,
+    922, 923, 898, 899, 900, 901, 902, 903, 904, 905, 906, 907, 908, 909,
+    910, 911, 912, 913, 914, 915, 916, 917, 918, 919, 920, 921, 922, 923,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    924, 925, 926, 927, 928, 929, 930, 931, 932, 933, 934, 935, 936, 937,
+    938, 939, 940, 941, 942, 943, 944, 945, 946, 947, 948, 949, 950, 951,
+    952, 953, 954, 955, 956, 957, 958, 959, 960, 961, 962, 963, 964, 965,
+    966, 967, 968, 969, 970, 971, 924, 925, 926, 927, 928, 929, 930, 931,
+    932, 933, 934, 935, 936, 937, 938, 939,
+  },
+  {
+    940, 941, 942, 943, 944, 945, 946, 947, 948, 949, 950, 951, 952, 953,
+    954, 955, 956, 957, 958, 959, 960, 961, 962, 963, 964, 965, 966, 967,
+    968, 969, 970, 971, 972, 972, 234, 659, 237, 213, 215, 973, 973, 974,
+    974, 975, 975, 227, 236, 226, 228, 0, 976, 976, 0, 977, 977, 0, 0, 0,
+    0, 0, 0, 0, 216, 217,
+  },
+  {
+    978, 978, 979, 979, 980, 980, 981, 981, 982, 982, 983, 983, 984, 984,
+    985, 985, 986, 986, 987, 987, 988, 988, 989, 989, 990, 990, 991, 991,
+    992, 992, 993, 993, 994, 994, 995, 995, 996, 996, 997, 997, 998, 998,
+    999, 999, 1000, 1000, 1001, 1001, 1002, 1002, 1003, 1003, 1004, 1004,
+    1005, 1005, 1006, 1006, 1007, 1007, 1008, 1008, 1009, 1009,
+  },
+  {
+    1010, 1010, 1011, 1011, 1012, 1012, 1013, 1013, 1014, 1014, 1015, 1015,
+    1016, 1016, 1017, 1017, 1018, 1018, 1019, 1019, 1020, 1020, 1021, 1021,
+    1022, 1022, 1023, 1023, 1024, 1024, 1025, 1025, 1026, 1026, 1027, 1027,
+    0, 0, 0, 0, 0, 0, 0, 1028, 1028, 1029, 1029, 0, 0, 0, 1030, 1030, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    485, 486, 487, 488, 489, 490, 491, 492, 493, 494, 495, 496, 497, 498,
+    499, 500, 501, 502, 503, 504, 505, 506, 507, 508, 509, 510, 511, 512,
+    513, 514, 515, 516, 517, 518, 519, 520, 521, 522, 0, 523, 0, 0, 0, 0,
+    0, 524, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    1031, 1031, 1032, 1032, 1033, 1033, 1034, 1034, 1035, 1035, 657, 657,
+    1036, 1036, 1037, 1037, 1038, 1038, 1039, 1039, 1040, 1040, 1041, 1041,
+    1042, 1042, 1043, 1043, 1044, 1044, 1045, 1045, 1046, 1046, 1047, 1047,
+    1048, 1048, 1049, 1049, 1050, 1050, 1051, 1051, 1052, 1052, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    1053, 1053, 1054, 1054, 1055, 1055, 1056, 1056, 1057, 1057, 1058, 1058,
+    1059, 1059, 1060, 1060, 1061, 1061, 1062, 1062, 1063, 1063, 1064, 1064,
+    1065, 1065, 1066, 1066, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1067, 1067, 1068, 1068, 1069, 1069, 1070,
+    1070, 1071, 1071, 1072, 1072, 1073, 1073, 0, 0, 1074, 1074, 1075, 1075,
+    1076, 1076, 1077, 1077, 1078, 1078, 1079, 1079, 1080, 1080,
+  },
+  {
+    1081, 1081, 1082, 1082, 1083, 1083, 1084, 1084, 1085, 1085, 1086, 1086,
+    1087, 1087, 1088, 1088, 1089, 1089, 1090, 1090, 1091, 1091, 1092, 1092,
+    1093, 1093, 1094, 1094, 1095, 1095, 1096, 1096, 1097, 1097, 1098, 1098,
+    1099, 1099, 1100, 1100, 1101, 1101, 1102, 1102, 1103, 1103, 1104, 1104,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1105, 1105, 1106, 1106, 658, 1107, 1107,
+  },
+  {
+    1108, 1108, 1109, 1109, 1110, 1110, 1111, 1111, 0, 0, 0, 1112, 1112,
+    231, 0, 0, 1113, 1113, 1114, 1114, 1115, 0, 1116, 1116, 1117, 1117,
+    1118, 1118, 1119, 1119, 1120, 1120, 1121, 1121, 1122, 1122, 1123, 1123,
+    1124, 1124, 1125, 1125, 232, 229, 230, 235, 233, 0, 241, 239, 240,
+    1126, 1127, 1127, 1128, 1128, 1129, 1129, 1130, 1130, 1131, 1131, 1132,
+    1132,
+  },
+  {
+    1133, 1133, 1134, 1134, 1115, 238, 660, 1135, 1135, 1136, 1136, 0, 0,
+    0, 0, 0, 1137, 1137, 0, 0, 0, 0, 1138, 1138, 1139, 1139, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1140,
+    1140, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1126, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 571, 572, 573, 574, 575, 576, 577, 578, 579, 580, 581, 582, 583,
+    584, 585, 586,
+  },
+  {
+    587, 588, 589, 590, 591, 592, 593, 594, 595, 596, 597, 598, 599, 600,
+    601, 602, 603, 604, 605, 606, 607, 608, 609, 610, 611, 612, 613, 614,
+    615, 616, 617, 618, 619, 620, 621, 622, 623, 624, 625, 626, 627, 628,
+    629, 630, 631, 632, 633, 634, 635, 636, 637, 638, 639, 640, 641, 642,
+    643, 644, 645, 646, 647, 648, 649, 650,
+  },
+  {
+    0, 0, 0, 0, 0, 1141, 1141, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1142, 1143, 1144, 1145, 1146, 1147, 1148,
+    1149, 1150, 1151, 1152, 1153, 1154, 1155, 1156, 1157, 1158, 1159, 1160,
+    1161, 1162, 1163, 1164, 1165, 1166, 1167, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 1142, 1143, 1144, 1145, 1146, 1147, 1148, 1149, 1150, 1151, 1152,
+    1153, 1154, 1155, 1156, 1157, 1158, 1159, 1160, 1161, 1162, 1163, 1164,
+    1165, 1166, 1167, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    1168, 1169, 1170, 1171, 1172, 1173, 1174, 1175, 1176, 1177, 1178, 1179,
+    1180, 1181, 1182, 1183, 1184, 1185, 1186, 1187, 1188, 1189, 1190, 1191,
+    1192, 1193, 1194, 1195, 1196, 1197, 1198, 1199, 1200, 1201, 1202, 1203,
+    1204, 1205, 1206, 1207, 1168, 1169, 1170, 1171, 1172, 1173, 1174, 1175,
+    1176, 1177, 1178, 1179, 1180, 1181, 1182, 1183, 1184, 1185, 1186, 1187,
+    1188, 1189, 1190, 1191,
+  },
+  {
+    1192, 1193, 1194, 1195, 1196, 1197, 1198, 1199, 1200, 1201, 1202, 1203,
+    1204, 1205, 1206, 1207, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1208, 1209, 1210, 1211, 1212, 1213, 1214, 1215, 1216, 1217, 1218, 1219,
+    1220, 1221, 1222, 1223,
+  },
+  {
+    1224, 1225, 1226, 1227, 1228, 1229, 1230, 1231, 1232, 1233, 1234, 1235,
+    1236, 1237, 1238, 1239, 1240, 1241, 1242, 1243, 0, 0, 0, 0, 1208, 1209,
+    1210, 1211, 1212, 1213, 1214, 1215, 1216, 1217, 1218, 1219, 1220, 1221,
+    1222, 1223, 1224, 1225, 1226, 1227, 1228, 1229, 1230, 1231, 1232, 1233,
+    1234, 1235, 1236, 1237, 1238, 1239, 1240, 1241, 1242, 1243, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1244, 1245, 1246, 1247, 1248, 1249, 1250, 1251, 1252, 1253, 1254, 0,
+    1255, 1256, 1257, 1258,
+  },
+  {
+    1259, 1260, 1261, 1262, 1263, 1264, 1265, 1266, 1267, 1268, 1269, 0,
+    1270, 1271, 1272, 1273, 1274, 1275, 1276, 0, 1277, 1278, 0, 1244, 1245,
+    1246, 1247, 1248, 1249, 1250, 1251, 1252, 1253, 1254, 0, 1255, 1256,
+    1257, 1258, 1259, 1260, 1261, 1262, 1263, 1264, 1265, 1266, 1267, 1268,
+    1269, 0, 1270, 1271, 1272, 1273, 1274, 1275, 1276, 0, 1277, 1278, 0, 0,
+    0,
+  },
+  {
+    1279, 1280, 1281, 1282, 1283, 1284, 1285, 1286, 1287, 1288, 1289, 1290,
+    1291, 1292, 1293, 1294, 1295, 1296, 1297, 1298, 1299, 1300, 1301, 1302,
+    1303, 1304, 1305, 1306, 1307, 1308, 1309, 1310, 1311, 1312, 1313, 1314,
+    1315, 1316, 1317, 1318, 1319, 1320, 1321, 1322, 1323, 1324, 1325, 1326,
+    1327, 1328, 1329, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 1330, 1331, 1332, 1333, 1334, 1335, 1336, 1337,
+    1338, 1339, 1340, 1341, 1342, 1343, 1344, 1345, 1346, 1347, 1348, 1349,
+    1350, 1351, 1352, 1353, 1354, 1355, 1356, 1357, 1358, 1359, 1360, 1361,
+  },
+  {
+    1330, 1331, 1332, 1333, 1334, 1335, 1336, 1337, 1338, 1339, 1340, 1341,
+    1342, 1343, 1344, 1345, 1346, 1347, 1348, 1349, 1350, 1351, 1352, 1353,
+    1354, 1355, 1356, 1357, 1358, 1359, 1360, 1361, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    1362, 1363, 1364, 1365, 1366, 1367, 1368, 1369, 1370, 1371, 1372, 1373,
+    1374, 1375, 1376, 1377, 1378, 1379, 1380, 1381, 1382, 1383, 1384, 1385,
+    1386, 1387, 1388, 1389, 1390, 1391, 1392, 1393, 1362, 1363, 1364, 1365,
+    1366, 1367, 1368, 1369, 1370, 1371, 1372, 1373, 1374, 1375, 1376, 1377,
+    1378, 1379, 1380, 1381, 1382, 1383, 1384, 1385, 1386, 1387, 1388, 1389,
+    1390, 1391, 1392, 1393,
+  },
+  {
+    1394, 1395, 1396, 1397, 1398, 1399, 1400, 1401, 1402, 1403, 1404, 1405,
+    1406, 1407, 1408, 1409, 1410, 1411, 1412, 1413, 1414, 1415, 1416, 1417,
+    1418, 1419, 1420, 1421, 1422, 1423, 1424, 1425, 1426, 1427, 1394, 1395,
+    1396, 1397, 1398, 1399, 1400, 1401, 1402, 1403, 1404, 1405, 1406, 1407,
+    1408, 1409, 1410, 1411, 1412, 1413, 1414, 1415, 1416, 1417, 1418, 1419,
+    1420, 1421, 1422, 1423,
+  },
+  {
+    1424, 1425, 1426, 1427, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+};
+
+/* chars of orbit i: foldchar[foldstart[i]..foldstart[i+1]-1] */
+static const unsigned short foldstart[1429] = {
+  0, 0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 23, 25, 27, 29, 31, 33, 35, 37,
+  40, 42, 44, 46, 48, 50, 52, 54, 57, 59, 61, 63, 65, 67, 70, 72, 74, 76,
+  78, 80, 82, 84, 86, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 108, 110,
+  112, 114, 116, 118, 120, 122, 124, 126, 128, 130, 132, 134, 136, 138,
+  140, 142, 144, 146, 148, 150, 152, 154, 156, 158, 160, 162, 164, 166,
+  168, 170, 172, 174, 176, 178, 180, 182, 184, 186, 188, 190, 192, 194,
+  196, 198, 200, 202, 204, 206, 208, 210, 212, 214, 216, 218, 220, 222,
+  224, 226, 228, 230, 232, 234, 236, 238, 240, 242, 244, 246, 248, 250,
+  252, 254, 256, 258, 260, 262, 264, 266, 268, 270, 272, 274, 276, 278,
+  280, 282, 284, 286, 288, 290, 292, 294, 296, 298, 300, 302, 304, 306,
+  308, 310, 312, 314, 316, 318, 320, 322, 324, 326, 329, 332, 335, 337,
+  339, 341, 343, 345, 347, 349, 351, 353, 355, 357, 359, 361, 363, 365,
+  367, 369, 372, 374, 376, 378, 380, 382, 384, 386, 388, 390, 392, 394,
+  396, 398, 400, 402, 404, 406, 408, 410, 412, 414, 416, 418, 420, 422,
+  424, 426, 428, 430, 432, 434, 436, 438, 440, 442, 444, 446, 448, 450,
+  452, 454, 456, 458, 460, 462, 464, 466, 468, 470, 472, 474, 476, 478,
+  480, 482, 484, 486, 488, 490, 494, 496, 498, 500, 502, 504, 506, 508,
+  510, 512, 514, 516, 518, 520, 522, 524, 526, 529, 531, 533, 536, 538,
+  540, 544, 547, 549, 551, 553, 555, 558, 561, 564, 566, 568, 571, 573,
+  575, 578, 580, 582, 584, 586, 588, 590, 592, 594, 596, 598, 600, 602,
+  604, 606, 608, 610, 612, 614, 616, 618, 620, 622, 624, 626, 628, 630,
+  632, 634, 636, 638, 640, 642, 644, 646, 648, 650, 652, 655, 657, 660,
+  662, 664, 666, 668, 670, 672, 674, 676, 678, 681, 683, 685, 688, 692,
+  694, 696, 698, 700, 702, 704, 706, 709, 711, 713, 715, 717, 719, 721,
+  724, 726, 728, 730, 732, 734, 736, 738, 740, 742, 744, 746, 748, 750,
+  752, 754, 756, 758, 760, 762, 764, 766, 768, 770, 772, 774, 776, 778,
+  780, 782, 784, 786, 788, 790, 792, 794, 796, 798, 800, 802, 804, 806,
+  808, 810, 812, 814, 816, 818, 820, 822, 824, 826, 828, 830, 832, 834,
+  836, 838, 840, 842, 844, 846, 848, 850, 852, 854, 856, 858, 860, 862,
+  864, 866, 868, 870, 872, 874, 876, 878, 880, 882, 884, 886, 888, 890,
+  892, 894, 896, 898, 900, 902, 904, 906, 908, 910, 912, 914, 916, 918,
+  920, 922, 924, 926, 928, 930, 932, 934, 936, 938, 940, 942, 944, 946,
+  948, 950, 952, 954, 956, 958, 960, 962, 964, 966, 968, 970, 972, 974,
+  976, 978, 980, 982, 984, 986, 988, 990, 992, 994, 996, 998, 1000, 1002,
+  1004, 1006, 1008, 1010, 1012, 1014, 1016, 1018, 1020, 1022, 1024, 1026,
+  1028, 1030, 1032, 1034, 1036, 1038, 1040, 1042, 1044, 1046, 1048, 1050,
+  1052, 1054, 1056, 1058, 1060, 1062, 1064, 1066, 1068, 1070, 1072, 1074,
+  1076, 1078, 1080, 1082, 1084, 1086, 1088, 1090, 1092, 1094, 1096, 1098,
+  1100, 1102, 1104, 1106, 1108, 1110, 1112, 1114, 1116, 1118, 1120, 1122,
+  1124, 1126, 1128, 1130, 1132, 1134, 1136, 1138, 1140, 1142, 1144, 1146,
+  1148, 1150, 1152, 1154, 1156, 1158, 1160, 1162, 1164, 1166, 1168, 1170,
+  1172, 1174, 1176, 1178, 1180, 1182, 1184, 1186, 1188, 1190, 1192, 1194,
+  1196, 1198, 1200, 1202, 1204, 1206, 1208, 1210, 1212, 1214, 1216, 1218,
+  1220, 1222, 1224, 1226, 1228, 1230, 1232, 1234, 1236, 1238, 1240, 1242,
+  1244, 1246, 1248, 1250, 1252, 1254, 1256, 1258, 1260, 1262, 1264, 1266,
+  1268, 1270, 1272, 1274, 1276, 1278, 1280, 1282, 1284, 1286, 1288, 1290,
+  1292, 1294, 1296, 1298, 1300, 1302, 1304, 1306, 1308, 1310, 1312, 1314,
+  1316, 1318, 1320, 1322, 1324, 1326, 1328, 1330, 1332, 1334, 1336, 1338,
+  1340, 1343, 1345, 1347, 1349, 1351, 1353, 1355, 1357, 1359, 1361, 1363,
+  1365, 1367, 1369, 1371, 1373, 1375, 1377, 1379, 1381, 1383, 1385, 1387,
+  1389, 1391, 1393, 1395, 1397, 1399, 1401, 1403, 1405, 1407, 1409, 1411,
+  1413, 1415, 1417, 1419, 1421, 1423, 1425, 1427, 1429, 1431, 1433, 1435,
+  1437, 1439, 1441, 1443, 1445, 1448, 1450, 1452, 1454, 1456, 1458, 1460,
+  1462, 1464, 1466, 1468, 1470, 1472, 1474, 1476, 1478, 1480, 1482, 1484,
+  1486, 1488, 1490, 1492, 1494, 1496, 1498, 1500, 1502, 1504, 1506, 1508,
+  1510, 1512, 1514, 1516, 1518, 1520, 1522, 1524, 1526, 1528, 1530, 1532,
+  1534, 1536, 1538, 1540, 1542, 1544, 1546, 1548, 1550, 1552, 1554, 1556,
+  1558, 1560, 1562, 1564, 1566, 1568, 1570, 1572, 1574, 1576, 1578, 1580,
+  1582, 1584, 1586, 1588, 1590, 1592, 1594, 1596, 1598, 1600, 1602, 1604,
+  1606, 1608, 1610, 1612, 1614, 1616, 1618, 1620, 1622, 1624, 1626, 1628,
+  1630, 1632, 1634, 1636, 1638, 1640, 1642, 1644, 1646, 1648, 1650, 1652,
+  1654, 1656, 1658, 1660, 1662, 1664, 1666, 1668, 1670, 1672, 1674, 1676,
+  1678, 1680, 1682, 1684, 1686, 1688, 1690, 1692, 1694, 1696, 1698, 1700,
+  1702, 1704, 1706, 1708, 1710, 1712, 1714, 1716, 1718, 1720, 1722, 1724,
+  1726, 1728, 1730, 1732, 1734, 1736, 1738, 1740, 1742, 1744, 1746, 1748,
+  1750, 1752, 1754, 1756, 1758, 1760, 1762, 1764, 1766, 1768, 1770, 1772,
+  1774, 1776, 1778, 1780, 1782, 1784, 1786, 1788, 1790, 1792, 1794, 1796,
+  1798, 1800, 1802, 1804, 1806, 1808, 1810, 1812, 1814, 1816, 1818, 1820,
+  1822, 1824, 1826, 1828, 1830, 1832, 1834, 1836, 1838, 1840, 1842, 1844,
+  1846, 1848, 1850, 1852, 1854, 1856, 1858, 1860, 1862, 1864, 1866, 1868,
+  1870, 1872, 1874, 1876, 1878, 1880, 1882, 1884, 1886, 1888, 1890, 1892,
+  1894, 1896, 1898, 1900, 1902, 1904, 1906, 1908, 1910, 1912, 1914, 1916,
+  1918, 1920, 1922, 1924, 1926, 1928, 1930, 1932, 1934, 1936, 1938, 1940,
+  1942, 1944, 1946, 1948, 1950, 1952, 1954, 1956, 1958, 1960, 1962, 1964,
+  1966, 1968, 1970, 1972, 1974, 1976, 1978, 1980, 1982, 1984, 1986, 1988,
+  1990, 1992, 1994, 1996, 1998, 2000, 2002, 2004, 2006, 2008, 2010, 2012,
+  2014, 2016, 2018, 2020, 2022, 2024, 2026, 2028, 2030, 2032, 2034, 2036,
+  2038, 2040, 2042, 2044, 2046, 2048, 2050, 2052, 2054, 2056, 2058, 2060,
+  2062, 2064, 2066, 2068, 2070, 2072, 2074, 2076, 2078, 2080, 2082, 2084,
+  2086, 2088, 2090, 2092, 2094, 2096, 2098, 2100, 2102, 2104, 2106, 2108,
+  2110, 2112, 2114, 2116, 2118, 2120, 2122, 2124, 2126, 2128, 2130, 2132,
+  2134, 2136, 2138, 2140, 2142, 2144, 2146, 2148, 2150, 2152, 2154, 2156,
+  2158, 2160, 2162, 2164, 2166, 2168, 2170, 2172, 2174, 2176, 2178, 2180,
+  2182, 2184, 2186, 2188, 2190, 2192, 2194, 2196, 2198, 2200, 2202, 2204,
+  2206, 2208, 2210, 2212, 2214, 2216, 2218, 2220, 2222, 2224, 2226, 2228,
+  2230, 2232, 2234, 2236, 2238, 2240, 2242, 2244, 2246, 2248, 2250, 2252,
+  2254, 2256, 2258, 2260, 2262, 2264, 2266, 2268, 2270, 2272, 2274, 2276,
+  2278, 2280, 2282, 2284, 2286, 2288, 2290, 2292, 2294, 2296, 2298, 2300,
+  2302, 2304, 2306, 2308, 2310, 2312, 2314, 2316, 2318, 2320, 2322, 2324,
+  2326, 2328, 2330, 2332, 2334, 2336, 2338, 2340, 2342, 2344, 2346, 2348,
+  2350, 2352, 2354, 2356, 2358, 2360, 2362, 2364, 2366, 2368, 2370, 2372,
+  2374, 2376, 2378, 2380, 2382, 2384, 2386, 2388, 2390, 2392, 2394, 2396,
+  2398, 2400, 2402, 2404, 2406, 2408, 2410, 2412, 2414, 2416, 2418, 2420,
+  2422, 2424, 2426, 2428, 2430, 2432, 2434, 2436, 2438, 2440, 2442, 2444,
+  2446, 2448, 2450, 2452, 2454, 2456, 2458, 2460, 2462, 2464, 2466, 2468,
+  2470, 2472, 2474, 2476, 2478, 2480, 2482, 2484, 2486, 2488, 2490, 2492,
+  2494, 2496, 2498, 2500, 2502, 2504, 2506, 2508, 2510, 2512, 2514, 2516,
+  2518, 2520, 2522, 2524, 2526, 2528, 2530, 2532, 2534, 2536, 2538, 2540,
+  2542, 2544, 2546, 2548, 2550, 2552, 2554, 2556, 2558, 2560, 2562, 2564,
+  2566, 2568, 2570, 2572, 2574, 2576, 2578, 2580, 2582, 2584, 2586, 2588,
+  2590, 2592, 2594, 2596, 2598, 2600, 2602, 2604, 2606, 2608, 2610, 2612,
+  2614, 2616, 2618, 2620, 2622, 2624, 2626, 2628, 2630, 2632, 2634, 2636,
+  2638, 2640, 2642, 2644, 2646, 2648, 2650, 2652, 2654, 2656, 2658, 2660,
+  2662, 2664, 2666, 2668, 2670, 2672, 2674, 2676, 2678, 2680, 2682, 2684,
+  2686, 2688, 2690, 2692, 2694, 2696, 2698, 2700, 2702, 2704, 2706, 2708,
+  2710, 2712, 2714, 2716, 2718, 2720, 2722, 2724, 2726, 2728, 2730, 2732,
+  2734, 2736, 2738, 2740, 2742, 2744, 2746, 2748, 2750, 2752, 2754, 2756,
+  2758, 2760, 2762, 2764, 2766, 2768, 2770, 2772, 2774, 2776, 2778, 2780,
+  2782, 2784, 2786, 2788, 2790, 2792, 2794, 2796, 2798, 2800, 2802, 2804,
+  2806, 2808, 2810, 2812, 2814, 2816, 2818, 2820, 2822, 2824, 2826, 2828,
+  2830, 2832, 2834, 2836, 2838, 2840, 2842, 2844, 2846, 2848, 2850, 2852,
+  2854, 2856, 2858, 2860, 2862, 2864, 2866, 2868, 2870, 2872, 2874, 2876,
+  2878, 2880, 2882, 2884,
+};
+
+static const int foldchar[2884] = {
+  0x0041, 0x0061, 0x0042, 0x0062, 0x0043, 0x0063, 0x0044, 0x0064, 0x0045,
+  0x0065, 0x0046, 0x0066, 0x0047, 0x0067, 0x0048, 0x0068, 0x0049, 0x0069,
+  0x004A, 0x006A, 0x004B, 0x006B, 0x212A, 0x004C, 0x006C, 0x004D, 0x006D,
+  0x004E, 0x006E, 0x004F, 0x006F, 0x0050, 0x0070, 0x0051, 0x0071, 0x0052,
+  0x0072, 0x0053, 0x0073, 0x017F, 0x0054, 0x0074, 0x0055, 0x0075, 0x0056,
+  0x0076, 0x0057, 0x0077, 0x0058, 0x0078, 0x0059, 0x0079, 0x005A, 0x007A,
+  0x00B5, 0x039C, 0x03BC, 0x00C0, 0x00E0, 0x00C1, 0x00E1, 0x00C2, 0x00E2,
+  0x00C3, 0x00E3, 0x00C4, 0x00E4, 0x00C5, 0x00E5, 0x212B, 0x00C6, 0x00E6,
+  0x00C7, 0x00E7, 0x00C8, 0x00E8, 0x00C9, 0x00E9, 0x00CA, 0x00EA, 0x00CB,
+  0x00EB, 0x00CC, 0x00EC, 0x00CD, 0x00ED, 0x00CE, 0x00EE, 0x00CF, 0x00EF,
+  0x00D0, 0x00F0, 0x00D1, 0x00F1, 0x00D2, 0x00F2, 0x00D3, 0x00F3, 0x00D4,
+  0x00F4, 0x00D5, 0x00F5, 0x00D6, 0x00F6, 0x00D8, 0x00F8, 0x00D9, 0x00F9,
+  0x00DA, 0x00FA, 0x00DB, 0x00FB, 0x00DC, 0x00FC, 0x00DD, 0x00FD, 0x00DE,
+  0x00FE, 0x00DF, 0x1E9E, 0x00FF, 0x0178, 0x0100, 0x0101, 0x0102, 0x0103,
+  0x0104, 0x0105, 0x0106, 0x0107, 0x0108, 0x0109, 0x010A, 0x010B, 0x010C,
+  0x010D, 0x010E, 0x010F, 0x0110, 0x0111, 0x0112, 0x0113, 0x0114, 0x0115,
+  0x0116, 0x0117, 0x0118, 0x0119, 0x011A, 0x011B, 0x011C, 0x011D, 0x011E,
+  0x011F, 0x0120, 0x0121, 0x0122, 0x0123, 0x0124, 0x0125, 0x0126, 0x0127,
+  0x0128, 0x0129, 0x012A, 0x012B, 0x012C, 0x012D, 0x012E, 0x012F, 0x0132,
+  0x0133, 0x0134, 0x0135, 0x0136, 0x0137, 0x0139, 0x013A, 0x013B, 0x013C,
+  0x013D, 0x013E, 0x013F, 0x0140, 0x0141, 0x0142, 0x0143, 0x0144, 0x0145,
+  0x0146, 0x0147, 0x0148, 0x014A, 0x014B, 0x014C, 0x014D, 0x014E, 0x014F,
+  0x0150, 0x0151, 0x0152, 0x0153, 0x0154, 0x0155, 0x0156, 0x0157, 0x0158,
+  0x0159, 0x015A, 0x015B, 0x015C, 0x015D, 0x015E, 0x015F, 0x0160, 0x0161,
+  0x0162, 0x0163, 0x0164, 0x0165, 0x0166, 0x0167, 0x0168, 0x0169, 0x016A,
+  0x016B, 0x016C, 0x016D, 0x016E, 0x016F, 0x0170, 0x0171, 0x0172, 0x0173,
+  0x0174, 0x0175, 0x0176, 0x0177, 0x0179, 0x017A, 0x017B, 0x017C, 0x017D,
+  0x017E, 0x0180, 0x0243, 0x0181, 0x0253, 0x0182, 0x0183, 0x0184, 0x0185,
+  0x0186, 0x0254, 0x0187, 0x0188, 0x0189, 0x0256, 0x018A, 0x0257, 0x018B,
+  0x018C, 0x018E, 0x01DD, 0x018F, 0x0259, 0x0190, 0x025B, 0x0191, 0x0192,
+  0x0193, 0x0260, 0x0194, 0x0263, 0x0195, 0x01F6, 0x0196, 0x0269, 0x0197,
+  0x0268, 0x0198, 0x0199, 0x019A, 0x023D, 0x019C, 0x026F, 0x019D, 0x0272,
+  0x019E, 0x0220, 0x019F, 0x0275, 0x01A0, 0x01A1, 0x01A2, 0x01A3, 0x01A4,
+  0x01A5, 0x01A6, 0x0280, 0x01A7, 0x01A8, 0x01A9, 0x0283, 0x01AC, 0x01AD,
+  0x01AE, 0x0288, 0x01AF, 0x01B0, 0x01B1, 0x028A, 0x01B2, 0x028B, 0x01B3,
+  0x01B4, 0x01B5, 0x01B6, 0x01B7, 0x0292, 0x01B8, 0x01B9, 0x01BC, 0x01BD,
+  0x01BF, 0x01F7, 0x01C4, 0x01C5, 0x01C6, 0x01C7, 0x01C8, 0x01C9, 0x01CA,
+  0x01CB, 0x01CC, 0x01CD, 0x01CE, 0x01CF, 0x01D0, 0x01D1, 0x01D2, 0x01D3,
+  0x01D4, 0x01D5, 0x01D6, 0x01D7, 0x01D8, 0x01D9, 0x01DA, 0x01DB, 0x01DC,
+  0x01DE, 0x01DF, 0x01E0, 0x01E1, 0x01E2, 0x01E3, 0x01E4, 0x01E5, 0x01E6,
+  0x01E7, 0x01E8, 0x01E9, 0x01EA, 0x01EB, 0x01EC, 0x01ED, 0x01EE, 0x01EF,
+  0x01F1, 0x01F2, 0x01F3, 0x01F4, 0x01F5, 0x01F8, 0x01F9, 0x01FA, 0x01FB,
+  0x01FC, 0x01FD, 0x01FE, 0x01FF, 0x0200, 0x0201, 0x0202, 0x0203, 0x0204,
+  0x0205, 0x0206, 0x0207, 0x0208, 0x0209, 0x020A, 0x020B, 0x020C, 0x020D,
+  0x020E, 0x020F, 0x0210, 0x0211, 0x0212, 0x0213, 0x0214, 0x0215, 0x0216,
+  0x0217, 0x0218, 0x0219, 0x021A, 0x021B, 0x021C, 0x021D, 0x021E, 0x021F,
+  0x0222, 0x0223, 0x0224, 0x0225, 0x0226, 0x0227, 0x0228, 0x0229, 0x022A,
+  0x022B, 0x022C, 0x022D, 0x022E, 0x022F, 0x0230, 0x0231, 0x0232, 0x0233,
+  0x023A, 0x2C65, 0x023B, 0x023C, 0x023E, 0x2C66, 0x023F, 0x2C7E, 0x0240,
+  0x2C7F, 0x0241, 0x0242, 0x0244, 0x0289, 0x0245, 0x028C, 0x0246, 0x0247,
+  0x0248, 0x0249, 0x024A, 0x024B, 0x024C, 0x024D, 0x024E, 0x024F, 0x0250,
+  0x2C6F, 0x0251, 0x2C6D, 0x0252, 0x2C70, 0x025C, 0xA7AB, 0x0261, 0xA7AC,
+  0x0265, 0xA78D, 0x0266, 0xA7AA, 0x026A, 0xA7AE, 0x026B, 0x2C62, 0x026C,
+  0xA7AD, 0x0271, 0x2C6E, 0x027D, 0x2C64, 0x0282, 0xA7C5, 0x0287, 0xA7B1,
+  0x029D, 0xA7B2, 0x029E, 0xA7B0, 0x0345, 0x0399, 0x03B9, 0x1FBE, 0x0370,
+  0x0371, 0x0372, 0x0373, 0x0376, 0x0377, 0x037B, 0x03FD, 0x037C, 0x03FE,
+  0x037D, 0x03FF, 0x037F, 0x03F3, 0x0386, 0x03AC, 0x0388, 0x03AD, 0x0389,
+  0x03AE, 0x038A, 0x03AF, 0x038C, 0x03CC, 0x038E, 0x03CD, 0x038F, 0x03CE,
+  0x0390, 0x1FD3, 0x0391, 0x03B1, 0x0392, 0x03B2, 0x03D0, 0x0393, 0x03B3,
+  0x0394, 0x03B4, 0x0395, 0x03B5, 0x03F5, 0x0396, 0x03B6, 0x0397, 0x03B7,
+  0x0398, 0x03B8, 0x03D1, 0x03F4, 0x039A, 0x03BA, 0x03F0, 0x039B, 0x03BB,
+  0x039D, 0x03BD, 0x039E, 0x03BE, 0x039F, 0x03BF, 0x03A0, 0x03C0, 0x03D6,
+  0x03A1, 0x03C1, 0x03F1, 0x03A3, 0x03C2, 0x03C3, 0x03A4, 0x03C4, 0x03A5,
+  0x03C5, 0x03A6, 0x03C6, 0x03D5, 0x03A7, 0x03C7, 0x03A8, 0x03C8, 0x03A9,
+  0x03C9, 0x2126, 0x03AA, 0x03CA, 0x03AB, 0x03CB, 0x03B0, 0x1FE3, 0x03CF,
+  0x03D7, 0x03D8, 0x03D9, 0x03DA, 0x03DB, 0x03DC, 0x03DD, 0x03DE, 0x03DF,
+  0x03E0, 0x03E1, 0x03E2, 0x03E3, 0x03E4, 0x03E5, 0x03E6, 0x03E7, 0x03E8,
+  0x03E9, 0x03EA, 0x03EB, 0x03EC, 0x03ED, 0x03EE, 0x03EF, 0x03F2, 0x03F9,
+  0x03F7, 0x03F8, 0x03FA, 0x03FB, 0x0400, 0x0450, 0x0401, 0x0451, 0x0402,
+  0x0452, 0x0403, 0x0453, 0x0404, 0x0454, 0x0405, 0x0455, 0x0406, 0x0456,
+  0x0407, 0x0457, 0x0408, 0x0458, 0x0409, 0x0459, 0x040A, 0x045A, 0x040B,
+  0x045B, 0x040C, 0x045C, 0x040D, 0x045D, 0x040E, 0x045E, 0x040F, 0x045F,
+  0x0410, 0x0430, 0x0411, 0x0431, 0x0412, 0x0432, 0x1C80, 0x0413, 0x0433,
+  0x0414, 0x0434, 0x1C81, 0x0415, 0x0435, 0x0416, 0x0436, 0x0417, 0x0437,
+  0x0418, 0x0438, 0x0419, 0x0439, 0x041A, 0x043A, 0x041B, 0x043B, 0x041C,
+  0x043C, 0x041D, 0x043D, 0x041E, 0x043E, 0x1C82, 0x041F, 0x043F, 0x0420,
+  0x0440, 0x0421, 0x0441, 0x1C83, 0x0422, 0x0442, 0x1C84, 0x1C85, 0x0423,
+  0x0443, 0x0424, 0x0444, 0x0425, 0x0445, 0x0426, 0x0446, 0x0427, 0x0447,
+  0x0428, 0x0448, 0x0429, 0x0449, 0x042A, 0x044A, 0x1C86, 0x042B, 0x044B,
+  0x042C, 0x044C, 0x042D, 0x044D, 0x042E, 0x044E, 0x042F, 0x044F, 0x0460,
+  0x0461, 0x0462, 0x0463, 0x1C87, 0x0464, 0x0465, 0x0466, 0x0467, 0x0468,
+  0x0469, 0x046A, 0x046B, 0x046C, 0x046D, 0x046E, 0x046F, 0x0470, 0x0471,
+  0x0472, 0x0473, 0x0474, 0x0475, 0x0476, 0x0477, 0x0478, 0x0479, 0x047A,
+  0x047B, 0x047C, 0x047D, 0x047E, 0x047F, 0x0480, 0x0481, 0x048A, 0x048B,
+  0x048C, 0x048D, 0x048E, 0x048F, 0x0490, 0x0491, 0x0492, 0x0493, 0x0494,
+  0x0495, 0x0496, 0x0497, 0x0498, 0x0499, 0x049A, 0x049B, 0x049C, 0x049D,
+  0x049E, 0x049F, 0x04A0, 0x04A1, 0x04A2, 0x04A3, 0x04A4, 0x04A5, 0x04A6,
+  0x04A7, 0x04A8, 0x04A9, 0x04AA, 0x04AB, 0x04AC, 0x04AD, 0x04AE, 0x04AF,
+  0x04B0, 0x04B1, 0x04B2, 0x04B3, 0x04B4, 0x04B5, 0x04B6, 0x04B7, 0x04B8,
+  0x04B9, 0x04BA, 0x04BB, 0x04BC, 0x04BD, 0x04BE, 0x04BF, 0x04C0, 0x04CF,
+  0x04C1, 0x04C2, 0x04C3, 0x04C4, 0x04C5, 0x04C6, 0x04C7, 0x04C8, 0x04C9,
+  0x04CA, 0x04CB, 0x04CC, 0x04CD, 0x04CE, 0x04D0, 0x04D1, 0x04D2, 0x04D3,
+  0x04D4, 0x04D5, 0x04D6, 0x04D7, 0x04D8, 0x04D9, 0x04DA, 0x04DB, 0x04DC,
+  0x04DD, 0x04DE, 0x04DF, 0x04E0, 0x04E1, 0x04E2, 0x04E3, 0x04E4, 0x04E5,
+  0x04E6, 0x04E7, 0x04E8, 0x04E9, 0x04EA, 0x04EB, 0x04EC, 0x04ED, 0x04EE,
+  0x04EF, 0x04F0, 0x04F1, 0x04F2, 0x04F3, 0x04F4, 0x04F5, 0x04F6, 0x04F7,
+  0x04F8, 0x04F9, 0x04FA, 0x04FB, 0x04FC, 0x04FD, 0x04FE, 0x04FF, 0x0500,
+  0x0501, 0x0502, 0x0503, 0x0504, 0x0505, 0x0506, 0x0507, 0x0508, 0x0509,
+  0x050A, 0x050B, 0x050C, 0x050D, 0x050E, 0x050F, 0x0510, 0x0511, 0x0512,
+  0x0513, 0x0514, 0x0515, 0x0516, 0x0517, 0x0518, 0x0519, 0x051A, 0x051B,
+  0x051C, 0x051D, 0x051E, 0x051F, 0x0520, 0x0521, 0x0522, 0x0523, 0x0524,
+  0x0525, 0x0526, 0x0527, 0x0528, 0x0529, 0x052A, 0x052B, 0x052C, 0x052D,
+  0x052E, 0x052F, 0x0531, 0x0561, 0x0532, 0x0562, 0x0533, 0x0563, 0x0534,
+  0x0564, 0x0535, 0x0565, 0x0536, 0x0566, 0x0537, 0x0567, 0x0538, 0x0568,
+  0x0539, 0x0569, 0x053A, 0x056A, 0x053B, 0x056B, 0x053C, 0x056C, 0x053D,
+  0x056D, 0x053E, 0x056E, 0x053F, 0x056F, 0x0540, 0x0570, 0x0541, 0x0571,
+  0x0542, 0x0572, 0x0543, 0x0573, 0x0544, 0x0574, 0x0545, 0x0575, 0x0546,
+  0x0576, 0x0547, 0x0577, 0x0548, 0x0578, 0x0549, 0x0579, 0x054A, 0x057A,
+  0x054B, 0x057B, 0x054C, 0x057C, 0x054D, 0x057D, 0x054E, 0x057E, 0x054F,
+  0x057F, 0x0550, 0x0580, 0x0551, 0x0581, 0x0552, 0x0582, 0x0553, 0x0583,
+  0x0554, 0x0584, 0x0555, 0x0585, 0x0556, 0x0586, 0x10A0, 0x2D00, 0x10A1,
+  0x2D01, 0x10A2, 0x2D02, 0x10A3, 0x2D03, 0x10A4, 0x2D04, 0x10A5, 0x2D05,
+  0x10A6, 0x2D06, 0x10A7, 0x2D07, 0x10A8, 0x2D08, 0x10A9, 0x2D09, 0x10AA,
+  0x2D0A, 0x10AB, 0x2D0B, 0x10AC, 0x2D0C, 0x10AD, 0x2D0D, 0x10AE, 0x2D0E,
+  0x10AF, 0x2D0F, 0x10B0, 0x2D10, 0x10B1, 0x2D11, 0x10B2, 0x2D12, 0x10B3,
+  0x2D13, 0x10B4, 0x2D14, 0x10B5, 0x2D15, 0x10B6, 0x2D16, 0x10B7, 0x2D17,
+  0x10B8, 0x2D18, 0x10B9, 0x2D19, 0x10BA, 0x2D1A, 0x10BB, 0x2D1B, 0x10BC,
+  0x2D1C, 0x10BD, 0x2D1D, 0x10BE, 0x2D1E, 0x10BF, 0x2D1F, 0x10C0, 0x2D20,
+  0x10C1, 0x2D21, 0x10C2, 0x2D22, 0x10C3, 0x2D23, 0x10C4, 0x2D24, 0x10C5,
+  0x2D25, 0x10C7, 0x2D27, 0x10CD, 0x2D2D, 0x10D0, 0x1C90, 0x10D1, 0x1C91,
+  0x10D2, 0x1C92, 0x10D3, 0x1C93, 0x10D4, 0x1C94, 0x10D5, 0x1C95, 0x10D6,
+  0x1C96, 0x10D7, 0x1C97, 0x10D8, 0x1C98, 0x10D9, 0x1C99, 0x10DA, 0x1C9A,
+  0x10DB, 0x1C9B, 0x10DC, 0x1C9C, 0x10DD, 0x1C9D, 0x10DE, 0x1C9E, 0x10DF,
+  0x1C9F, 0x10E0, 0x1CA0, 0x10E1, 0x1CA1, 0x10E2, 0x1CA2, 0x10E3, 0x1CA3,
+  0x10E4, 0x1CA4, 0x10E5, 0x1CA5, 0x10E6, 0x1CA6, 0x10E7, 0x1CA7, 0x10E8,
+  0x1CA8, 0x10E9, 0x1CA9, 0x10EA, 0x1CAA, 0x10EB, 0x1CAB, 0x10EC, 0x1CAC,
+  0x10ED, 0x1CAD, 0x10EE, 0x1CAE, 0x10EF, 0x1CAF, 0x10F0, 0x1CB0, 0x10F1,
+  0x1CB1, 0x10F2, 0x1CB2, 0x10F3, 0x1CB3, 0x10F4, 0x1CB4, 0x10F5, 0x1CB5,
+  0x10F6, 0x1CB6, 0x10F7, 0x1CB7, 0x10F8, 0x1CB8, 0x10F9, 0x1CB9, 0x10FA,
+  0x1CBA, 0x10FD, 0x1CBD, 0x10FE, 0x1CBE, 0x10FF, 0x1CBF, 0x13A0, 0xAB70,
+  0x13A1, 0xAB71, 0x13A2, 0xAB72, 0x13A3, 0xAB73, 0x13A4, 0xAB74, 0x13A5,
+  0xAB75, 0x13A6, 0xAB76, 0x13A7, 0xAB77, 0x13A8, 0xAB78, 0x13A9, 0xAB79,
+  0x13AA, 0xAB7A, 0x13AB, 0xAB7B, 0x13AC, 0xAB7C, 0x13AD, 0xAB7D, 0x13AE,
+  0xAB7E, 0x13AF, 0xAB7F, 0x13B0, 0xAB80, 0x13B1, 0xAB81, 0x13B2, 0xAB82,
+  0x13B3, 0xAB83, 0x13B4, 0xAB84, 0x13B5, 0xAB85, 0x13B6, 0xAB86, 0x13B7,
+  0xAB87, 0x13B8, 0xAB88, 0x13B9, 0xAB89, 0x13BA, 0xAB8A, 0x13BB, 0xAB8B,
+  0x13BC, 0xAB8C, 0x13BD, 0xAB8D, 0x13BE, 0xAB8E, 0x13BF, 0xAB8F, 0x13C0,
+  0xAB90, 0x13C1, 0xAB91, 0x13C2, 0xAB92, 0x13C3, 0xAB93, 0x13C4, 0xAB94,
+  0x13C5, 0xAB95, 0x13C6, 0xAB96, 0x13C7, 0xAB97, 0x13C8, 0xAB98, 0x13C9,
+  0xAB99, 0x13CA, 0xAB9A, 0x13CB, 0xAB9B, 0x13CC, 0xAB9C, 0x13CD, 0xAB9D,
+  0x13CE, 0xAB9E, 0x13CF, 0xAB9F, 0x13D0, 0xABA0, 0x13D1, 0xABA1, 0x13D2,
+  0xABA2, 0x13D3, 0xABA3, 0x13D4, 0xABA4, 0x13D5, 0xABA5, 0x13D6, 0xABA6,
+  0x13D7, 0xABA7, 0x13D8, 0xABA8, 0x13D9, 0xABA9, 0x13DA, 0xABAA, 0x13DB,
+  0xABAB, 0x13DC, 0xABAC, 0x13DD, 0xABAD, 0x13DE, 0xABAE, 0x13DF, 0xABAF,
+  0x13E0, 0xABB0, 0x13E1, 0xABB1, 0x13E2, 0xABB2, 0x13E3, 0xABB3, 0x13E4,
+  0xABB4, 0x13E5, 0xABB5, 0x13E6, 0xABB6, 0x13E7, 0xABB7, 0x13E8, 0xABB8,
+  0x13E9, 0xABB9, 0x13EA, 0xABBA, 0x13EB, 0xABBB, 0x13EC, 0xABBC, 0x13ED,
+  0xABBD, 0x13EE, 0xABBE, 0x13EF, 0xABBF, 0x13F0, 0x13F8, 0x13F1, 0x13F9,
+  0x13F2, 0x13FA, 0x13F3, 0x13FB, 0x13F4, 0x13FC, 0x13F5, 0x13FD, 0x1C88,
+  0xA64A, 0xA64B, 0x1D79, 0xA77D, 0x1D7D, 0x2C63, 0x1D8E, 0xA7C6, 0x1E00,
+  0x1E01, 0x1E02, 0x1E03, 0x1E04, 0x1E05, 0x1E06, 0x1E07, 0x1E08, 0x1E09,
+  0x1E0A, 0x1E0B, 0x1E0C, 0x1E0D, 0x1E0E, 0x1E0F, 0x1E10, 0x1E11, 0x1E12,
+  0x1E13, 0x1E14, 0x1E15, 0x1E16, 0x1E17, 0x1E18, 0x1E19, 0x1E1A, 0x1E1B,
+  0x1E1C, 0x1E1D, 0x1E1E, 0x1E1F, 0x1E20, 0x1E21, 0x1E22, 0x1E23, 0x1E24,
+  0x1E25, 0x1E26, 0x1E27, 0x1E28, 0x1E29, 0x1E2A, 0x1E2B, 0x1E2C, 0x1E2D,
+  0x1E2E, 0x1E2F, 0x1E30, 0x1E31, 0x1E32, 0x1E33, 0x1E34, 0x1E35, 0x1E36,
+  0x1E37, 0x1E38, 0x1E39, 0x1E3A, 0x1E3B, 0x1E3C, 0x1E3D, 0x1E3E, 0x1E3F,
+  0x1E40, 0x1E41, 0x1E42, 0x1E43, 0x1E44, 0x1E45, 0x1E46, 0x1E47, 0x1E48,
+  0x1E49, 0x1E4A, 0x1E4B, 0x1E4C, 0x1E4D, 0x1E4E, 0x1E4F, 0x1E50, 0x1E51,
+  0x1E52, 0x1E53, 0x1E54, 0x1E55, 0x1E56, 0x1E57, 0x1E58, 0x1E59, 0x1E5A,
+  0x1E5B, 0x1E5C, 0x1E5D, 0x1E5E, 0x1E5F, 0x1E60, 0x1E61, 0x1E9B, 0x1E62,
+  0x1E63, 0x1E64, 0x1E65, 0x1E66, 0x1E67, 0x1E68, 0x1E69, 0x1E6A, 0x1E6B,
+  0x1E6C, 0x1E6D, 0x1E6E, 0x1E6F, 0x1E70, 0x1E71, 0x1E72, 0x1E73, 0x1E74,
+  0x1E75, 0x1E76, 0x1E77, 0x1E78, 0x1E79, 0x1E7A, 0x1E7B, 0x1E7C, 0x1E7D,
+  0x1E7E, 0x1E7F, 0x1E80, 0x1E81, 0x1E82, 0x1E83, 0x1E84, 0x1E85, 0x1E86,
+  0x1E87, 0x1E88, 0x1E89, 0x1E8A, 0x1E8B, 0x1E8C, 0x1E8D, 0x1E8E, 0x1E8F,
+  0x1E90, 0x1E91, 0x1E92, 0x1E93, 0x1E94, 0x1E95, 0x1EA0, 0x1EA1, 0x1EA2,
+  0x1EA3, 0x1EA4, 0x1EA5, 0x1EA6, 0x1EA7, 0x1EA8, 0x1EA9, 0x1EAA, 0x1EAB,
+  0x1EAC, 0x1EAD, 0x1EAE, 0x1EAF, 0x1EB0, 0x1EB1, 0x1EB2, 0x1EB3, 0x1EB4,
+  0x1EB5, 0x1EB6, 0x1EB7, 0x1EB8, 0x1EB9, 0x1EBA, 0x1EBB, 0x1EBC, 0x1EBD,
+  0x1EBE, 0x1EBF, 0x1EC0, 0x1EC1, 0x1EC2, 0x1EC3, 0x1EC4, 0x1EC5, 0x1EC6,
+  0x1EC7, 0x1EC8, 0x1EC9, 0x1ECA, 0x1ECB, 0x1ECC, 0x1ECD, 0x1ECE, 0x1ECF,
+  0x1ED0, 0x1ED1, 0x1ED2, 0x1ED3, 0x1ED4, 0x1ED5, 0x1ED6, 0x1ED7, 0x1ED8,
+  0x1ED9, 0x1EDA, 0x1EDB, 0x1EDC, 0x1EDD, 0x1EDE, 0x1EDF, 0x1EE0, 0x1EE1,
+  0x1EE2, 0x1EE3, 0x1EE4, 0x1EE5, 0x1EE6, 0x1EE7, 0x1EE8, 0x1EE9, 0x1EEA,
+  0x1EEB, 0x1EEC, 0x1EED, 0x1EEE, 0x1EEF, 0x1EF0, 0x1EF1, 0x1EF2, 0x1EF3,
+  0x1EF4, 0x1EF5, 0x1EF6, 0x1EF7, 0x1EF8, 0x1EF9, 0x1EFA, 0x1EFB, 0x1EFC,
+  0x1EFD, 0x1EFE, 0x1EFF, 0x1F00, 0x1F08, 0x1F01, 0x1F09, 0x1F02, 0x1F0A,
+  0x1F03, 0x1F0B, 0x1F04, 0x1F0C, 0x1F05, 0x1F0D, 0x1F06, 0x1F0E, 0x1F07,
+  0x1F0F, 0x1F10, 0x1F18, 0x1F11, 0x1F19, 0x1F12, 0x1F1A, 0x1F13, 0x1F1B,
+  0x1F14, 0x1F1C, 0x1F15, 0x1F1D, 0x1F20, 0x1F28, 0x1F21, 0x1F29, 0x1F22,
+  0x1F2A, 0x1F23, 0x1F2B, 0x1F24, 0x1F2C, 0x1F25, 0x1F2D, 0x1F26, 0x1F2E,
+  0x1F27, 0x1F2F, 0x1F30, 0x1F38, 0x1F31, 0x1F39, 0x1F32, 0x1F3A, 0x1F33,
+  0x1F3B, 0x1F34, 0x1F3C, 0x1F35, 0x1F3D, 0x1F36, 0x1F3E, 0x1F37, 0x1F3F,
+  0x1F40, 0x1F48, 0x1F41, 0x1F49, 0x1F42, 0x1F4A, 0x1F43, 0x1F4B, 0x1F44,
+  0x1F4C, 0x1F45, 0x1F4D, 0x1F51, 0x1F59, 0x1F53, 0x1F5B, 0x1F55, 0x1F5D,
+  0x1F57, 0x1F5F, 0x1F60, 0x1F68, 0x1F61, 0x1F69, 0x1F62, 0x1F6A, 0x1F63,
+  0x1F6B, 0x1F64, 0x1F6C, 0x1F65, 0x1F6D, 0x1F66, 0x1F6E, 0x1F67, 0x1F6F,
+  0x1F70, 0x1FBA, 0x1F71, 0x1FBB, 0x1F72, 0x1FC8, 0x1F73, 0x1FC9, 0x1F74,
+  0x1FCA, 0x1F75, 0x1FCB, 0x1F76, 0x1FDA, 0x1F77, 0x1FDB, 0x1F78, 0x1FF8,
+  0x1F79, 0x1FF9, 0x1F7A, 0x1FEA, 0x1F7B, 0x1FEB, 0x1F7C, 0x1FFA, 0x1F7D,
+  0x1FFB, 0x1F80, 0x1F88, 0x1F81, 0x1F89, 0x1F82, 0x1F8A, 0x1F83, 0x1F8B,
+  0x1F84, 0x1F8C, 0x1F85, 0x1F8D, 0x1F86, 0x1F8E, 0x1F87, 0x1F8F, 0x1F90,
+  0x1F98, 0x1F91, 0x1F99, 0x1F92, 0x1F9A, 0x1F93, 0x1F9B, 0x1F94, 0x1F9C,
+  0x1F95, 0x1F9D, 0x1F96, 0x1F9E, 0x1F97, 0x1F9F, 0x1FA0, 0x1FA8, 0x1FA1,
+  0x1FA9, 0x1FA2, 0x1FAA, 0x1FA3, 0x1FAB, 0x1FA4, 0x1FAC, 0x1FA5, 0x1FAD,
+  0x1FA6, 0x1FAE, 0x1FA7, 0x1FAF, 0x1FB0, 0x1FB8, 0x1FB1, 0x1FB9, 0x1FB3,
+  0x1FBC, 0x1FC3, 0x1FCC, 0x1FD0, 0x1FD8, 0x1FD1, 0x1FD9, 0x1FE0, 0x1FE8,
+  0x1FE1, 0x1FE9, 0x1FE5, 0x1FEC, 0x1FF3, 0x1FFC, 0x2132, 0x214E, 0x2160,
+  0x2170, 0x2161, 0x2171, 0x2162, 0x2172, 0x2163, 0x2173, 0x2164, 0x2174,
+  0x2165, 0x2175, 0x2166, 0x2176, 0x2167, 0x2177, 0x2168, 0x2178, 0x2169,
+  0x2179, 0x216A, 0x217A, 0x216B, 0x217B, 0x216C, 0x217C, 0x216D, 0x217D,
+  0x216E, 0x217E, 0x216F, 0x217F, 0x2183, 0x2184, 0x24B6, 0x24D0, 0x24B7,
+  0x24D1, 0x24B8, 0x24D2, 0x24B9, 0x24D3, 0x24BA, 0x24D4, 0x24BB, 0x24D5,
+  0x24BC, 0x24D6, 0x24BD, 0x24D7, 0x24BE, 0x24D8, 0x24BF, 0x24D9, 0x24C0,
+  0x24DA, 0x24C1, 0x24DB, 0x24C2, 0x24DC, 0x24C3, 0x24DD, 0x24C4, 0x24DE,
+  0x24C5, 0x24DF, 0x24C6, 0x24E0, 0x24C7, 0x24E1, 0x24C8, 0x24E2, 0x24C9,
+  0x24E3, 0x24CA, 0x24E4, 0x24CB, 0x24E5, 0x24CC, 0x24E6, 0x24CD, 0x24E7,
+  0x24CE, 0x24E8, 0x24CF, 0x24E9, 0x2C00, 0x2C30, 0x2C01, 0x2C31, 0x2C02,
+  0x2C32, 0x2C03, 0x2C33, 0x2C04, 0x2C34, 0x2C05, 0x2C35, 0x2C06, 0x2C36,
+  0x2C07, 0x2C37, 0x2C08, 0x2C38, 0x2C09, 0x2C39, 0x2C0A, 0x2C3A, 0x2C0B,
+  0x2C3B, 0x2C0C, 0x2C3C, 0x2C0D, 0x2C3D, 0x2C0E, 0x2C3E, 0x2C0F, 0x2C3F,
+  0x2C10, 0x2C40, 0x2C11, 0x2C41, 0x2C12, 0x2C42, 0x2C13, 0x2C43, 0x2C14,
+  0x2C44, 0x2C15, 0x2C45, 0x2C16, 0x2C46, 0x2C17, 0x2C47, 0x2C18, 0x2C48,
+  0x2C19, 0x2C49, 0x2C1A, 0x2C4A, 0x2C1B, 0x2C4B, 0x2C1C, 0x2C4C, 0x2C1D,
+  0x2C4D, 0x2C1E, 0x2C4E, 0x2C1F, 0x2C4F, 0x2C20, 0x2C50, 0x2C21, 0x2C51,
+  0x2C22, 0x2C52, 0x2C23, 0x2C53, 0x2C24, 0x2C54, 0x2C25, 0x2C55, 0x2C26,
+  0x2C56, 0x2C27, 0x2C57, 0x2C28, 0x2C58, 0x2C29, 0x2C59, 0x2C2A, 0x2C5A,
+  0x2C2B, 0x2C5B, 0x2C2C, 0x2C5C, 0x2C2D, 0x2C5D, 0x2C2E, 0x2C5E, 0x2C2F,
+  0x2C5F, 0x2C60, 0x2C61, 0x2C67, 0x2C68, 0x2C69, 0x2C6A, 0x2C6B, 0x2C6C,
+  0x2C72, 0x2C73, 0x2C75, 0x2C76, 0x2C80, 0x2C81, 0x2C82, 0x2C83, 0x2C84,
+  0x2C85, 0x2C86, 0x2C87, 0x2C88, 0x2C89, 0x2C8A, 0x2C8B, 0x2C8C, 0x2C8D,
+  0x2C8E, 0x2C8F, 0x2C90, 0x2C91, 0x2C92, 0x2C93, 0x2C94, 0x2C95, 0x2C96,
+  0x2C97, 0x2C98, 0x2C99, 0x2C9A, 0x2C9B, 0x2C9C, 0x2C9D, 0x2C9E, 0x2C9F,
+  0x2CA0, 0x2CA1, 0x2CA2, 0x2CA3, 0x2CA4, 0x2CA5, 0x2CA6, 0x2CA7, 0x2CA8,
+  0x2CA9, 0x2CAA, 0x2CAB, 0x2CAC, 0x2CAD, 0x2CAE, 0x2CAF, 0x2CB0, 0x2CB1,
+  0x2CB2, 0x2CB3, 0x2CB4, 0x2CB5, 0x2CB6, 0x2CB7, 0x2CB8, 0x2CB9, 0x2CBA,
+  0x2CBB, 0x2CBC, 0x2CBD, 0x2CBE, 0x2CBF, 0x2CC0, 0x2CC1, 0x2CC2, 0x2CC3,
+  0x2CC4, 0x2CC5, 0x2CC6, 0x2CC7, 0x2CC8, 0x2CC9, 0x2CCA, 0x2CCB, 0x2CCC,
+  0x2CCD, 0x2CCE, 0x2CCF, 0x2CD0, 0x2CD1, 0x2CD2, 0x2CD3, 0x2CD4, 0x2CD5,
+  0x2CD6, 0x2CD7, 0x2CD8, 0x2CD9, 0x2CDA, 0x2CDB, 0x2CDC, 0x2CDD, 0x2CDE,
+  0x2CDF, 0x2CE0, 0x2CE1, 0x2CE2, 0x2CE3, 0x2CEB, 0x2CEC, 0x2CED, 0x2CEE,
+  0x2CF2, 0x2CF3, 0xA640, 0xA641, 0xA642, 0xA643, 0xA644, 0xA645, 0xA646,
+  0xA647, 0xA648, 0xA649, 0xA64C, 0xA64D, 0xA64E, 0xA64F, 0xA650, 0xA651,
+  0xA652, 0xA653, 0xA654, 0xA655, 0xA656, 0xA657, 0xA658, 0xA659, 0xA65A,
+  0xA65B, 0xA65C, 0xA65D, 0xA65E, 0xA65F, 0xA660, 0xA661, 0xA662, 0xA663,
+  0xA664, 0xA665, 0xA666, 0xA667, 0xA668, 0xA669, 0xA66A, 0xA66B, 0xA66C,
+  0xA66D, 0xA680, 0xA681, 0xA682, 0xA683, 0xA684, 0xA685, 0xA686, 0xA687,
+  0xA688, 0xA689, 0xA68A, 0xA68B, 0xA68C, 0xA68D, 0xA68E, 0xA68F, 0xA690,
+  0xA691, 0xA692, 0xA693, 0xA694, 0xA695, 0xA696, 0xA697, 0xA698, 0xA699,
+  0xA69A, 0xA69B, 0xA722, 0xA723, 0xA724, 0xA725, 0xA726, 0xA727, 0xA728,
+  0xA729, 0xA72A, 0xA72B, 0xA72C, 0xA72D, 0xA72E, 0xA72F, 0xA732, 0xA733,
+  0xA734, 0xA735, 0xA736, 0xA737, 0xA738, 0xA739, 0xA73A, 0xA73B, 0xA73C,
+  0xA73D, 0xA73E, 0xA73F, 0xA740, 0xA741, 0xA742, 0xA743, 0xA744, 0xA745,
+  0xA746, 0xA747, 0xA748, 0xA749, 0xA74A, 0xA74B, 0xA74C, 0xA74D, 0xA74E,
+  0xA74F, 0xA750, 0xA751, 0xA752, 0xA753, 0xA754, 0xA755, 0xA756, 0xA757,
+  0xA758, 0xA759, 0xA75A, 0xA75B, 0xA75C, 0xA75D, 0xA75E, 0xA75F, 0xA760,
+  0xA761, 0xA762, 0xA763, 0xA764, 0xA765, 0xA766, 0xA767, 0xA768, 0xA769,
+  0xA76A, 0xA76B, 0xA76C, 0xA76D, 0xA76E, 0xA76F, 0xA779, 0xA77A, 0xA77B,
+  0xA77C, 0xA77E, 0xA77F, 0xA780, 0xA781, 0xA782, 0xA783, 0xA784, 0xA785,
+  0xA786, 0xA787, 0xA78B, 0xA78C, 0xA790, 0xA791, 0xA792, 0xA793, 0xA794,
+  0xA7C4, 0xA796, 0xA797, 0xA798, 0xA799, 0xA79A, 0xA79B, 0xA79C, 0xA79D,
+  0xA79E, 0xA79F, 0xA7A0, 0xA7A1, 0xA7A2, 0xA7A3, 0xA7A4, 0xA7A5, 0xA7A6,
+  0xA7A7, 0xA7A8, 0xA7A9, 0xA7B3, 0xAB53, 0xA7B4, 0xA7B5, 0xA7B6, 0xA7B7,
+  0xA7B8, 0xA7B9, 0xA7BA, 0xA7BB, 0xA7BC, 0xA7BD, 0xA7BE, 0xA7BF, 0xA7C0,
+  0xA7C1, 0xA7C2, 0xA7C3, 0xA7C7, 0xA7C8, 0xA7C9, 0xA7CA, 0xA7D0, 0xA7D1,
+  0xA7D6, 0xA7D7, 0xA7D8, 0xA7D9, 0xA7F5, 0xA7F6, 0xFB05, 0xFB06, 0xFF21,
+  0xFF41, 0xFF22, 0xFF42, 0xFF23, 0xFF43, 0xFF24, 0xFF44, 0xFF25, 0xFF45,
+  0xFF26, 0xFF46, 0xFF27, 0xFF47, 0xFF28, 0xFF48, 0xFF29, 0xFF49, 0xFF2A,
+  0xFF4A, 0xFF2B, 0xFF4B, 0xFF2C, 0xFF4C, 0xFF2D, 0xFF4D, 0xFF2E, 0xFF4E,
+  0xFF2F, 0xFF4F, 0xFF30, 0xFF50, 0xFF31, 0xFF51, 0xFF32, 0xFF52, 0xFF33,
+  0xFF53, 0xFF34, 0xFF54, 0xFF35, 0xFF55, 0xFF36, 0xFF56, 0xFF37, 0xFF57,
+  0xFF38, 0xFF58, 0xFF39, 0xFF59, 0xFF3A, 0xFF5A, 0x10400, 0x10428,
+  0x10401, 0x10429, 0x10402, 0x1042A, 0x10403, 0x1042B, 0x10404, 0x1042C,
+  0x10405, 0x1042D, 0x10406, 0x1042E, 0x10407, 0x1042F, 0x10408, 0x10430,
+  0x10409, 0x10431, 0x1040A, 0x10432, 0x1040B, 0x10433, 0x1040C, 0x10434,
+  0x1040D, 0x10435, 0x1040E, 0x10436, 0x1040F, 0x10437, 0x10410, 0x10438,
+  0x10411, 0x10439, 0x10412, 0x1043A, 0x10413, 0x1043B, 0x10414, 0x1043C,
+  0x10415, 0x1043D, 0x10416, 0x1043E, 0x10417, 0x1043F, 0x10418, 0x10440,
+  0x10419, 0x10441, 0x1041A, 0x10442, 0x1041B, 0x10443, 0x1041C, 0x10444,
+  0x1041D, 0x10445, 0x1041E, 0x10446, 0x1041F, 0x10447, 0x10420, 0x10448,
+  0x10421, 0x10449, 0x10422, 0x1044A, 0x10423, 0x1044B, 0x10424, 0x1044C,
+  0x10425, 0x1044D, 0x10426, 0x1044E, 0x10427, 0x1044F, 0x104B0, 0x104D8,
+  0x104B1, 0x104D9, 0x104B2, 0x104DA, 0x104B3, 0x104DB, 0x104B4, 0x104DC,
+  0x104B5, 0x104DD, 0x104B6, 0x104DE, 0x104B7, 0x104DF, 0x104B8, 0x104E0,
+  0x104B9, 0x104E1, 0x104BA, 0x104E2, 0x104BB, 0x104E3, 0x104BC, 0x104E4,
+  0x104BD, 0x104E5, 0x104BE, 0x104E6, 0x104BF, 0x104E7, 0x104C0, 0x104E8,
+  0x104C1, 0x104E9, 0x104C2, 0x104EA, 0x104C3, 0x104EB, 0x104C4, 0x104EC,
+  0x104C5, 0x104ED, 0x104C6, 0x104EE, 0x104C7, 0x104EF, 0x104C8, 0x104F0,
+  0x104C9, 0x104F1, 0x104CA, 0x104F2, 0x104CB, 0x104F3, 0x104CC, 0x104F4,
+  0x104CD, 0x104F5, 0x104CE, 0x104F6, 0x104CF, 0x104F7, 0x104D0, 0x104F8,
+  0x104D1, 0x104F9, 0x104D2, 0x104FA, 0x104D3, 0x104FB, 0x10570, 0x10597,
+  0x10571, 0x10598, 0x10572, 0x10599, 0x10573, 0x1059A, 0x10574, 0x1059B,
+  0x10575, 0x1059C, 0x10576, 0x1059D, 0x10577, 0x1059E, 0x10578, 0x1059F,
+  0x10579, 0x105A0, 0x1057A, 0x105A1, 0x1057C, 0x105A3, 0x1057D, 0x105A4,
+  0x1057E, 0x105A5, 0x1057F, 0x105A6, 0x10580, 0x105A7, 0x10581, 0x105A8,
+  0x10582, 0x105A9, 0x10583, 0x105AA, 0x10584, 0x105AB, 0x10585, 0x105AC,
+  0x10586, 0x105AD, 0x10587, 0x105AE, 0x10588, 0x105AF, 0x10589, 0x105B0,
+  0x1058A, 0x105B1, 0x1058C, 0x105B3, 0x1058D, 0x105B4, 0x1058E, 0x105B5,
+  0x1058F, 0x105B6, 0x10590, 0x105B7, 0x10591, 0x105B8, 0x10592, 0x105B9,
+  0x10594, 0x105BB, 0x10595, 0x105BC, 0x10C80, 0x10CC0, 0x10C81, 0x10CC1,
+  0x10C82, 0x10CC2, 0x10C83, 0x10CC3, 0x10C84, 0x10CC4, 0x10C85, 0x10CC5,
+  0x10C86, 0x10CC6, 0x10C87, 0x10CC7, 0x10C88, 0x10CC8, 0x10C89, 0x10CC9,
+  0x10C8A, 0x10CCA, 0x10C8B, 0x10CCB, 0x10C8C, 0x10CCC, 0x10C8D, 0x10CCD,
+  0x10C8E, 0x10CCE, 0x10C8F, 0x10CCF, 0x10C90, 0x10CD0, 0x10C91, 0x10CD1,
+  0x10C92, 0x10CD2, 0x10C93, 0x10CD3, 0x10C94, 0x10CD4, 0x10C95, 0x10CD5,
+  0x10C96, 0x10CD6, 0x10C97, 0x10CD7, 0x10C98, 0x10CD8, 0x10C99, 0x10CD9,
+  0x10C9A, 0x10CDA, 0x10C9B, 0x10CDB, 0x10C9C, 0x10CDC, 0x10C9D, 0x10CDD,
+  0x10C9E, 0x10CDE, 0x10C9F, 0x10CDF, 0x10CA0, 0x10CE0, 0x10CA1, 0x10CE1,
+  0x10CA2, 0x10CE2, 0x10CA3, 0x10CE3, 0x10CA4, 0x10CE4, 0x10CA5, 0x10CE5,
+  0x10CA6, 0x10CE6, 0x10CA7, 0x10CE7, 0x10CA8, 0x10CE8, 0x10CA9, 0x10CE9,
+  0x10CAA, 0x10CEA, 0x10CAB, 0x10CEB, 0x10CAC, 0x10CEC, 0x10CAD, 0x10CED,
+  0x10CAE, 0x10CEE, 0x10CAF, 0x10CEF, 0x10CB0, 0x10CF0, 0x10CB1, 0x10CF1,
+  0x10CB2, 0x10CF2, 0x118A0, 0x118C0, 0x118A1, 0x118C1, 0x118A2, 0x118C2,
+  0x118A3, 0x118C3, 0x118A4, 0x118C4, 0x118A5, 0x118C5, 0x118A6, 0x118C6,
+  0x118A7, 0x118C7, 0x118A8, 0x118C8, 0x118A9, 0x118C9, 0x118AA, 0x118CA,
+  0x118AB, 0x118CB, 0x118AC, 0x118CC, 0x118AD, 0x118CD, 0x118AE, 0x118CE,
+  0x118AF, 0x118CF, 0x118B0, 0x118D0, 0x118B1, 0x118D1, 0x118B2, 0x118D2,
+  0x118B3, 0x118D3, 0x118B4, 0x118D4, 0x118B5, 0x118D5, 0x118B6, 0x118D6,
+  0x118B7, 0x118D7, 0x118B8, 0x118D8, 0x118B9, 0x118D9, 0x118BA, 0x118DA,
+  0x118BB, 0x118DB, 0x118BC, 0x118DC, 0x118BD, 0x118DD, 0x118BE, 0x118DE,
+  0x118BF, 0x118DF, 0x16E40, 0x16E60, 0x16E41, 0x16E61, 0x16E42, 0x16E62,
+  0x16E43, 0x16E63, 0x16E44, 0x16E64, 0x16E45, 0x16E65, 0x16E46, 0x16E66,
+  0x16E47, 0x16E67, 0x16E48, 0x16E68, 0x16E49, 0x16E69, 0x16E4A, 0x16E6A,
+  0x16E4B, 0x16E6B, 0x16E4C, 0x16E6C, 0x16E4D, 0x16E6D, 0x16E4E, 0x16E6E,
+  0x16E4F, 0x16E6F, 0x16E50, 0x16E70, 0x16E51, 0x16E71, 0x16E52, 0x16E72,
+  0x16E53, 0x16E73, 0x16E54, 0x16E74, 0x16E55, 0x16E75, 0x16E56, 0x16E76,
+  0x16E57, 0x16E77, 0x16E58, 0x16E78, 0x16E59, 0x16E79, 0x16E5A, 0x16E7A,
+  0x16E5B, 0x16E7B, 0x16E5C, 0x16E7C, 0x16E5D, 0x16E7D, 0x16E5E, 0x16E7E,
+  0x16E5F, 0x16E7F, 0x1E900, 0x1E922, 0x1E901, 0x1E923, 0x1E902, 0x1E924,
+  0x1E903, 0x1E925, 0x1E904, 0x1E926, 0x1E905, 0x1E927, 0x1E906, 0x1E928,
+  0x1E907, 0x1E929, 0x1E908, 0x1E92A, 0x1E909, 0x1E92B, 0x1E90A, 0x1E92C,
+  0x1E90B, 0x1E92D, 0x1E90C, 0x1E92E, 0x1E90D, 0x1E92F, 0x1E90E, 0x1E930,
+  0x1E90F, 0x1E931, 0x1E910, 0x1E932, 0x1E911, 0x1E933, 0x1E912, 0x1E934,
+  0x1E913, 0x1E935, 0x1E914, 0x1E936, 0x1E915, 0x1E937, 0x1E916, 0x1E938,
+  0x1E917, 0x1E939, 0x1E918, 0x1E93A, 0x1E919, 0x1E93B, 0x1E91A, 0x1E93C,
+  0x1E91B, 0x1E93D, 0x1E91C, 0x1E93E, 0x1E91D, 0x1E93F, 0x1E91E, 0x1E940,
+  0x1E91F, 0x1E941, 0x1E920, 0x1E942, 0x1E921, 0x1E943,
+};
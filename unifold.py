@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Generate unifold.h, the tables for Unicode simple case folding.
+
+Usage: python3 unifold.py CaseFolding.txt > unifold.h
+
+CaseFolding.txt is from the Unicode Character Database, e.g.
+https://www.unicode.org/Public/15.0.0/ucd/CaseFolding.txt; its version
+is recorded in the header of unifold.h. Simple case folding maps
+a character to a single character (the C and S entries); characters that
+fold to the same one make up a case orbit, like k, K and U+212A KELVIN
+SIGN. The tables give the orbit of each character (two-stage: a block of
+64 characters, then the character within the block) and the members of
+each orbit.
+"""
+
+import re
+import sys
+
+SHIFT = 6
+
+
+def readfolds(path):
+    """return the version and the simple case folding of the file"""
+    version, fold = None, {}
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            m = re.match(r"#\s*CaseFolding-(\S+)\.txt", line)
+            if m and not version:
+                version = m.group(1)
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            code, status, mapping = (x.strip() for x in line.split(";")[:3])
+            if status in ("C", "S"):
+                fold[int(code, 16)] = int(mapping, 16)
+    if not version or not fold:
+        sys.exit("unifold.py: %s is not CaseFolding.txt" % path)
+    return version, fold
+
+
+def rows(values, fmt, indent="  ", width=76):
+    """format values for a C initializer, as many per line as fit"""
+    out, line = [], indent
+    for v in values:
+        item = fmt % v + ","
+        if len(line) + len(item) + 1 > width and line.strip():
+            out.append(line.rstrip())
+            line = indent
+        line += item + " "
+    if line.strip():
+        out.append(line.rstrip())
+    return "\n".join(out)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: python3 unifold.py CaseFolding.txt > unifold.h")
+    version, fold = readfolds(sys.argv[1])
+    orbits = {}
+    for c, f in fold.items():
+        orbits.setdefault(f, {f}).add(c)
+    orbits = sorted(sorted(o) for o in orbits.values())
+
+    number = {}
+    for i, orbit in enumerate(orbits, 1):
+        for c in orbit:
+            number[c] = i
+
+    blocks, index = {}, []
+    for b in range((max(number) >> SHIFT) + 1):
+        block = tuple(number.get((b << SHIFT) + j, 0) for j in range(1 << SHIFT))
+        index.append(blocks.setdefault(block, len(blocks)))
+    assert len(blocks) <= 256
+
+    start, chars = [0], []
+    for orbit in orbits:
+        start.append(len(chars))
+        chars.extend(orbit)
+    start.append(len(chars))
+
+    w = sys.stdout.write
+    w("/* Unicode simple case folding, generated by unifold.py from\n")
+    w(" * CaseFolding-%s.txt: do not edit. */\n\n" % version)
+    w("#define FOLD_SHIFT %d\n" % SHIFT)
+    w("#define NFOLDORBIT %d\n\n" % len(orbits))
+    w("/* orbit of c < %d << FOLD_SHIFT (0 for none):\n" % len(index))
+    w("   foldblock[foldindex[c >> FOLD_SHIFT]][c & ((1 << FOLD_SHIFT) - 1)] */\n")
+    w("static const unsigned char foldindex[%d] = {\n" % len(index))
+    w(rows(index, "%d") + "\n};\n\n")
+    w("static const unsigned short foldblock[%d][%d] = {\n" % (len(blocks), 1 << SHIFT))
+    for block in blocks:
+        w("  {\n" + rows(block, "%d", "    ") + "\n  },\n")
+    w("};\n\n")
+    w("/* chars of orbit i: foldchar[foldstart[i]..foldstart[i+1]-1] */\n")
+    w("static const unsigned short foldstart[%d] = {\n" % len(start))
+    w(rows(start, "%d") + "\n};\n\n")
+    w("static const int foldchar[%d] = {\n" % len(chars))
+    w(rows(chars, "0x%04X") + "\n};\n")
+
+
+if __name__ == "__main__":
+    main()
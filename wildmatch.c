@@ -1,20 +1,97 @@
+#define _POSIX_C_SOURCE 200809L  /* for pthreads, sysconf, openat */
+#define _DEFAULT_SOURCE          /* for d_type in directory entries */
 
-#include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* iterative wildcard matching */
 /* with character classes and case folding */
 /* with special logic for path names and dot files */
 
 #include "wildmatch.h"
+#include "unifold.h"
+
+/* About statistics
+ *
+ * Compiled with WILDMATCH_STATS, the matchers count what they do
+ * (see struct wildmatch_stats): chars decoded, tokens tried, returns
+ * to a star, class tests, globstar tries and how deep they nest, and
+ * matches given up. The counters are per thread, so threads never
+ * share a cache line for them. Each string matched (a call) starts
+ * a fresh set, which is added to the totals when it is done, so a
+ * slow call can be told apart from many fast ones and pathological
+ * patterns found. Without WILDMATCH_STATS the counting macros are
+ * empty and wildmatch_stats() only reports zeros.
+ */
+
+#ifdef WILDMATCH_STATS
+static _Thread_local struct wildmatch_stats statcur, statlast, stattotal;
+#define STAT(field) (statcur.field++)
+#define STATMAX(field, n) (statcur.field = statcur.field > (n) ? statcur.field : (n))
+#define STATBEGIN() (memset(&statcur, 0, sizeof statcur), statcur.calls = 1)
+#define STATEND() statend()
+
+/** finish the counters of a call */
+static void
+statend(void)
+{
+  struct wildmatch_stats *t = &stattotal;
+  statlast = statcur;
+  t->calls += statcur.calls;
+  t->decoded += statcur.decoded;
+  t->steps += statcur.steps;
+  t->backtracks += statcur.backtracks;
+  t->classes += statcur.classes;
+  t->globstars += statcur.globstars;
+  t->memohits += statcur.memohits;
+  t->giveups += statcur.giveups;
+  if (t->maxdepth < statcur.maxdepth) t->maxdepth = statcur.maxdepth;
+}
+#else
+#define STAT(field) ((void) 0)
+#define STATMAX(field, n) ((void) 0)
+#define STATBEGIN() ((void) 0)
+#define STATEND() ((void) 0)
+#endif
 
-#define RECURSION_LIMIT 20
+int
+wildmatch_stats(struct wildmatch_stats *last, struct wildmatch_stats *total)
+{
+#ifdef WILDMATCH_STATS
+  if (last) *last = statlast;
+  if (total) *total = stattotal;
+  return true;
+#else
+  if (last) memset(last, 0, sizeof *last);
+  if (total) memset(total, 0, sizeof *total);
+  return false;
+#endif
+}
 
-#define MATCHED  0
-#define MISMATCH 1
-#define GIVEUP   2
+void
+wildmatch_stats_reset(void)
+{
+#ifdef WILDMATCH_STATS
+  memset(&statcur, 0, sizeof statcur);
+  memset(&statlast, 0, sizeof statlast);
+  memset(&stattotal, 0, sizeof stattotal);
+#endif
+}
 
 /* About UTF-8
  *
@@ -37,11 +114,43 @@
  * byte mandates. Overlong encodings of 7bit characters are
  * recognised and replaced by U+FFFD (replacement character),
  * as are surrogate pairs 0xD800..0xDFFF, which are not allowed
- * in UTF-8. However, overlong encodings of larger values are
- * not detected and bytes 0x80..0xBF are returned as-is, even
- * though they are not valid UTF-8.
+ * in UTF-8, and values beyond 0x10FFFF. However, overlong
+ * encodings of larger values are not detected and bytes
+ * 0x80..0xBF are returned as-is, even though they are not valid
+ * UTF-8.
+ *
+ * Strings are delimited by an end pointer (one past the last byte)
+ * and the decoder never reads at or beyond it; at the end it returns
+ * 0 (like for the NUL byte that terminates a C string).
+ *
+ * Most strings are plain ASCII, where each byte is a character
+ * and decoding can be skipped, and most others are well-formed
+ * UTF-8, where the first byte tells the number of continuation
+ * bytes and nothing needs to be replaced. A quick scan (utf8check)
+ * tells which is the case, skipping ASCII a vector at a time and
+ * checking other chars against the table of well-formed byte
+ * sequences of the Unicode standard (Table 3-7): no overlong
+ * forms, surrogates, values beyond 0x10FFFF, stray or missing
+ * continuation bytes. Only ill-formed strings need the decoder
+ * above; the result is the same either way. With STRICT, they
+ * do not match at all (nor do ill-formed patterns).
+ *
+ * With BYTES, patterns and strings are not decoded at all: each
+ * byte is a char, as in the C locale, which is right for Latin-1
+ * or any other single-byte encoding. Such strings are matched as
+ * if they were ASCII.
  */
 
+enum { UTF8_ASCII, UTF8_VALID, UTF8_INVALID };
+
+/* encoding not checked yet */
+#define UTF8_UNKNOWN (-1)
+
+/* encoding of strings matched with flags: a char per byte with BYTES */
+#define FLAGENC(flags) ((flags) & WILD_BYTES ? UTF8_ASCII : UTF8_UNKNOWN)
+
+static int utf8check(const char *s, const char *end);
+
 /* Payload of 1st byte & 0x3F given the two hi bits are 11 */
 static const unsigned char utf8tab[] = {
   0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,  /* 110x xxxx */
@@ -54,201 +163,3366 @@ static const unsigned char utf8tab[] = {
   0x00, 0x01, 0x02, 0x03, 0x00, 0x01, 0x00, 0x00,  /* 1111 10xx, 110x, 1110, 1111 */
 };
 
-/** return the UTF-8 encoded character at *p and increment *p */
+/** return the UTF-8 encoded character at *p and increment *p,
+    or return 0 if *p is at end; not counted (see utf8get) */
 static int
-utf8get(const char **pp)
+utf8decode(const char **pp, const char *end)
 {
   const int replacement = 0xFFFD;
   const char *s = *pp;
-  int c = (unsigned char) *s++;
+  unsigned u;
+  int c;
+  if (s >= end) return 0;
+  c = (unsigned char) *s++;
   if (c >= 0xC0) {
     /* get payload from low 6 bits of first byte */
-    c = utf8tab[c & 0x3F];
+    u = utf8tab[c & 0x3F];
     /* ingest continuation bytes (10xx xxxx) */
-    while ((*s & 0xC0) == 0x80) {
-      c = (c << 6) + ((unsigned char) *s++ & 0x3F);
+    while (s < end && (*s & 0xC0) == 0x80) {
+      u = (u << 6) + ((unsigned char) *s++ & 0x3F);
     }
-    /* replace overlong 7bit encodings and surrogate pairs */
-    if (c < 0x80 || (0xD800 <= c && c <= 0xDFFF)) {
-      c = replacement;
+    /* replace overlong 7bit encodings, surrogate pairs, too large values */
+    if (u < 0x80 || (0xD800 <= u && u <= 0xDFFF) || u > 0x10FFFF) {
+      u = replacement;
     }
+    c = (int) u;
   }
   *pp = s;
   return c;
 }
 
+/** same as utf8decode, counted as a char of the string decoded */
+static int
+utf8get(const char **pp, const char *end)
+{
+  if (*pp < end) STAT(decoded);
+  return utf8decode(pp, end);
+}
+
+/** return the character at *p of well-formed UTF-8 and increment *p,
+    or return 0 if *p is at end */
+static inline int
+utf8next(const char **pp, const char *end)
+{
+  const unsigned char *s = (const unsigned char *) *pp;
+  if (*pp >= end) return 0;
+  STAT(decoded);
+  if (s[0] < 0x80) {
+    *pp += 1;
+    return s[0];
+  }
+  if (s[0] < 0xE0) {
+    *pp += 2;
+    return (s[0] & 0x1F) << 6 | (s[1] & 0x3F);
+  }
+  if (s[0] < 0xF0) {
+    *pp += 3;
+    return (s[0] & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+  }
+  *pp += 4;
+  return (s[0] & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+}
+
+/** return the char at *p (up to end) and increment *p, decoding as
+    needed for the string's encoding enc (as told by utf8check) */
+static inline int
+nextchar(const char **pp, const char *end, int enc)
+{
+  if (enc == UTF8_ASCII) return *pp < end ? (unsigned char) *(*pp)++ : 0;
+  if (enc == UTF8_VALID) return utf8next(pp, end);
+  return utf8get(pp, end);
+}
+
+/* About the compiled pattern
+ *
+ * The pattern is translated once into a sequence of tokens:
+ * literal characters (already decoded and with the other case
+ * resolved), any character (?), character classes (see below),
+ * wild stars, and globstars (the double star
+ * recognised as such only with PATHNAME and only when delimited
+ * by slashes); the pattern ends with an END token. Each token
+ * also records if the pattern would match the empty remainder
+ * of a string from there (the isglobstar0 condition).
+ *
+ * A character class is compiled into a bitmap for characters
+ * 0..255 and a sorted list of disjoint ranges for all characters
+ * above; case folding and complement are applied at compile time
+ * to the bitmap, so a test is a single bit lookup for most chars.
+ *
+ * Most patterns contain literal text that any matching string
+ * must contain: at its start (prefix), at its end (suffix), or
+ * somewhere in between (the longest such run, infix). These are
+ * extracted from the tokens and checked with memcmp and memchr
+ * before matching, which quickly rejects most strings that do not
+ * match. Only ASCII literals are considered, because an ASCII
+ * byte in the string is always a character of its own (a decoded
+ * non-ASCII character has no unique encoding), unless all bytes
+ * are (with BYTES), and only tokens
+ * before any that may match the end of the string (zerotail).
+ *
+ * Many patterns are nothing but such literal text and stars: a
+ * literal (Makefile), a prefix (lib*), a suffix (*.o), or an
+ * infix (*tmp*). For these shapes, checking the literal text is
+ * all of matching, but for the rules for slashes and initial dots
+ * that the stars have to obey (see matchshape), so the shape is
+ * noted at compile time and the general matchers are skipped.
+ * An ill-formed pattern with STRICT has SHAPE_NONE: it matches
+ * nothing.
+ *
+ * Token, class, range, and literal arrays live in the same block
+ * of memory as the program header; compiling is done in two passes
+ * over the pattern: one to count, one to fill in.
+ */
+
+enum { OP_END, OP_LIT, OP_ANY, OP_CLASS, OP_STAR, OP_GLOB, OP_GLOBEND };
+
+enum { SHAPE_GENERAL, SHAPE_LITERAL, SHAPE_PREFIX, SHAPE_SUFFIX, SHAPE_INFIX,
+       SHAPE_NONE };
+
+struct token {
+  unsigned char op;
+  bool zerotail;      /* pattern matches end of string from here */
+  bool dotnext;       /* OP_STAR: followed by a literal dot */
+  int c, alt;         /* OP_LIT: char and its other case; OP_CLASS, OP_GLOB: index */
+};
+
+struct range {
+  int lo, hi;
+};
+
+struct cclass {
+  uint32_t bits[8];    /* chars 0..255, folded and complemented */
+  size_t first, count; /* sorted ranges above 255: slice of prog->rng */
+  bool compl;          /* complement of ranges */
+};
+
+struct literal {
+  size_t first, len;   /* slice of prog->lit (and prog->tok) */
+};
+
+struct wildprog {
+  int flags;
+  size_t ntok, nclass, nrange, nglob;
+  struct literal prefix, suffix, infix;  /* required literal text */
+  int shape;           /* SHAPE_GENERAL, or the literal text is all, or
+                          SHAPE_NONE if nothing matches (see STRICT) */
+  struct token *tok;
+  struct cclass *cls;
+  struct range *rng;
+  char *lit;           /* chars of ASCII literal tokens, else 0 */
+  uint64_t *mask;      /* tokens consuming chars 0..255, or 0 (see below) */
+  uint64_t star, tail, all, dot;  /* stars, zerotail, match any rest, initial dot */
+  uint64_t hiany, hitest;  /* tokens consuming all chars above 255, or some */
+  bool skip;           /* a star is followed by a byte literal (see skipstar) */
+};
+
 /** scan cclass, return length or 0 if not a cclass */
 static size_t
-scanbrack(const char *pat)
+scanbrack(const char *pat, const char *end)
 {
   /* assume opening bracket at pat[-1] */
-  size_t n = 0;
-  if (pat[n] == '!' || pat[n] == '^') n++; /* complement of class */
-  if (pat[n] == ']') n++; /* ordinary at start of class */
-  while (pat[n] && pat[n] != ']') n++; /* scan for end */
-  return pat[n] ? n+1 : 0; /* return length if found, 0 if not */
+  size_t n = 0, len = end - pat;
+  if (n < len && (pat[n] == '!' || pat[n] == '^')) n++; /* complement of class */
+  if (n < len && pat[n] == ']') n++; /* ordinary at start of class */
+  while (n < len && pat[n] != ']') n++; /* scan for end */
+  return n < len ? n+1 : 0; /* return length if found, 0 if not */
+}
+
+/* About case folding
+ *
+ * With CASEFOLD, ASCII letters match either case, whatever the
+ * locale (tolower and toupper depend on it, and are not defined
+ * for chars beyond a byte). Cases are resolved when compiling:
+ * each literal token gets its other case, each class bitmap both
+ * cases, and the required literal text (see findlits) is kept in
+ * lower case, so that checking it takes a table lookup per byte.
+ *
+ * UNIFOLD extends this to all of Unicode, with simple case folding
+ * (one char to one char, so that matching still goes char by char;
+ * ß does not match ss). Chars that fold to the same make up a case
+ * orbit, mostly of two (é, É) but up to four (θ, ϑ, Θ, ϴ), and the
+ * generated tables in unifold.h give the orbit of each char and the
+ * members of each orbit. A literal with an orbit of two gets the
+ * other member as its other case; a larger orbit becomes a class
+ * of its own (so k, which has the Kelvin sign in its orbit, is not
+ * an ASCII literal then); and a class gets the orbits of its chars.
+ * Again, all is resolved when compiling and matching never folds.
+ */
+
+/* Each byte in lower case (ASCII letters only) */
+static const unsigned char lowercase[256] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+  0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+  0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+  0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,  /* A..O */
+  0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F,  /* P..Z */
+  0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+  0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x7B, 0x7C, 0x7D, 0x7E, 0x7F,
+  0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F,
+  0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F,
+  0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF,
+  0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF,
+  0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF,
+  0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF,
+  0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF,
+  0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+};
+
+/** return c with case (lower/upper) swapped, for ASCII letters */
+static int
+swapcase(int c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A' + 'a';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 'A';
+  return c;
+}
+
+/** return the number of the case orbit of c, 0 if none */
+static size_t
+orbit(int c)
+{
+  if (c < 0 || (size_t) c >> FOLD_SHIFT >= sizeof foldindex) return 0;
+  return foldblock[foldindex[c >> FOLD_SHIFT]][c & ((1 << FOLD_SHIFT) - 1)];
 }
 
-/** return true iff sc or folded occur in cclass at pat */
+/** return true iff pat ends with slash-star-star or equivalent */
 static bool
-matchbrack(const char *pat, int sc, int folded)
+isglobstar0(int pc, const char *pat, const char *end)
 {
-  int pc;
+  if (pc != '/') return false;
+again:
+  if (pat < end && *pat == '*') pat++; else return false;
+  if (pat < end && *pat == '*') pat++; else return false;
+  for (; pat < end; pat++) {
+    if (*pat == '/') { pat++; goto again; }
+    if (*pat != '*') return false;
+  }
+  return true;
+}
+
+/** return true iff sc+str is a dotfile (but not ./ nor ../) */
+static bool
+isdotfile(int sc, const char *str, const char *end)
+{
+  if (sc != '.') return false;
+  if (str < end && *str == '/') return false;
+  if (end - str >= 2 && str[0] == '.' && str[1] == '/') return false;
+  return true;
+}
+
+#define SETBIT(bits, c) ((bits)[(c) >> 5] |= (uint32_t) 1 << ((c) & 31))
+#define GETBIT(bits, c) ((bits)[(c) >> 5] >> ((c) & 31) & 1)
+#define TESTPOS(set, i) ((set)[(i) >> 6] >> ((i) & 63) & 1)
+#define SETPOS(set, i) ((set)[(i) >> 6] |= (uint64_t) 1 << ((i) & 63))
+
+/** add range lo..hi to cclass (if any), count ranges above 255 */
+static void
+addrange(struct wildprog *prog, struct cclass *cls, int lo, int hi)
+{
+  int c;
+  if (lo > hi) return;
+  if (cls) {
+    for (c = lo < 0 ? 0 : lo; c <= hi && c < 256; c++) {
+      SETBIT(cls->bits, c);
+      if (prog->flags & WILD_CASEFOLD)
+        SETBIT(cls->bits, swapcase(c));
+    }
+  }
+  if (hi < 256) return;
+  if (prog->rng) {
+    prog->rng[prog->nrange].lo = lo < 256 ? 256 : lo;
+    prog->rng[prog->nrange].hi = hi;
+  }
+  prog->nrange++;
+}
+
+/** add the chars of case orbit i to cclass */
+static void
+addorbit(struct wildprog *prog, struct cclass *cls, size_t i)
+{
+  size_t j;
+  for (j = foldstart[i]; j < foldstart[i+1]; j++)
+    addrange(prog, cls, foldchar[j], foldchar[j]);
+}
+
+/** add range lo..hi to cclass, and with UNIFOLD the orbits of its chars */
+static void
+addchars(struct wildprog *prog, struct cclass *cls, int lo, int hi)
+{
+  size_t i, j;
+  int c;
+  addrange(prog, cls, lo, hi);
+  if (!(prog->flags & WILD_UNIFOLD) || lo > hi) return;
+  if (hi - lo < 64) {
+    for (c = lo; c <= hi; c++)
+      addorbit(prog, cls, orbit(c));
+    return;
+  }
+  for (i = 1; i <= NFOLDORBIT; i++) {
+    for (j = foldstart[i]; j < foldstart[i+1]; j++) {
+      if (lo <= foldchar[j] && foldchar[j] <= hi) {
+        addorbit(prog, cls, i);
+        break;
+      }
+    }
+  }
+}
+
+static int
+cmprange(const void *a, const void *b)
+{
+  const struct range *p = a, *q = b;
+  return p->lo < q->lo ? -1 : p->lo > q->lo;
+}
+
+/** finish cclass (if any) with the ranges from first on: sort and
+    merge those above 255, apply complement */
+static void
+endclass(struct wildprog *prog, struct cclass *cls, size_t first, bool compl)
+{
+  struct range *rng = prog->rng + first;
+  size_t i, j, n = prog->nrange - first;
+  prog->nclass++;
+  if (!cls) return;
+  qsort(rng, n, sizeof *rng, cmprange);
+  for (i = j = 0; i < n; i++) {
+    if (j > 0 && rng[i].lo <= rng[j-1].hi + 1) {
+      if (rng[i].hi > rng[j-1].hi) rng[j-1].hi = rng[i].hi;
+    }
+    else rng[j++] = rng[i];
+  }
+  prog->nrange = first + j;
+  cls->first = first;
+  cls->count = j;
+  cls->compl = compl;
+  if (compl)
+    for (i = 0; i < 8; i++) cls->bits[i] = ~cls->bits[i];
+}
+
+/** compile cclass at pat (opening bracket at pat[-1], closing
+    bracket before end, as found by scanbrack) */
+static void
+compbrack(struct wildprog *prog, const char *pat, const char *end)
+{
+  int pc, enc = FLAGENC(prog->flags);
   bool compl = false;
+  size_t first = prog->nrange;
+  struct cclass *cls = prog->cls ? &prog->cls[prog->nclass] : 0;
+  if (cls) memset(cls->bits, 0, sizeof cls->bits);
   if (*pat == '!' || *pat == '^') {
     compl = true;
     pat++;
   }
-  if (*pat == ']') {
-    if (sc == ']')
-      return !compl;
-    pat++;
-  }
-  else if (*pat == '-') {
-    if (sc == '-')
-      return !compl;
+  if (*pat == ']' || *pat == '-') {
+    addchars(prog, cls, *pat, *pat);
     pat++;
   }
   for (pc = pat[-1]; *pat != ']'; ) {
     if (pat[0] == '-' && pat[1] != ']') {
-      int lo, hi;
       pat++; /* skip the dash */
-      lo=pc, hi=utf8get(&pat);
-      if ((lo <= sc && sc <= hi) ||
-          (lo <= folded && folded <= hi))
-        return !compl;
+      addchars(prog, cls, pc, nextchar(&pat, end, enc));
     }
     else {
-      pc = utf8get(&pat);
-      if (pc == sc || pc == folded)
-        return !compl;
+      pc = nextchar(&pat, end, enc);
+      addchars(prog, cls, pc, pc);
     }
   }
-  return compl;
+  endclass(prog, cls, first, compl);
+}
+
+/** compile case orbit i into a cclass of its own */
+static void
+foldclass(struct wildprog *prog, size_t i)
+{
+  size_t first = prog->nrange;
+  struct cclass *cls = prog->cls ? &prog->cls[prog->nclass] : 0;
+  if (cls) memset(cls->bits, 0, sizeof cls->bits);
+  addorbit(prog, cls, i);
+  endclass(prog, cls, first, false);
+}
+
+/** append a token to prog (if any) and count it */
+static struct token *
+addtoken(struct wildprog *prog, int op, int c, int alt)
+{
+  struct token *tk;
+  if (op == OP_GLOB) prog->nglob++;
+  if (!prog->tok) {
+    prog->ntok++;
+    return 0;
+  }
+  tk = &prog->tok[prog->ntok++];
+  tk->op = op;
+  tk->zerotail = op == OP_END;
+  tk->dotnext = false;
+  tk->c = c;
+  tk->alt = alt;
+  return tk;
+}
+
+/** true iff token is a literal that is a single byte in the string
+    (in both cases): ASCII, or any with BYTES */
+#define ISBYTE(prog, tk) ((tk)->op == OP_LIT && \
+  (((tk)->c < 128 && (tk)->alt < 128) || ((prog)->flags & WILD_BYTES)))
+
+/** find literal text required at start, at end, and in between */
+static void
+findlits(struct wildprog *prog)
+{
+  const struct token *tk = prog->tok;
+  struct literal run;
+  size_t i, j, n;
+  bool fold = prog->flags & WILD_CASEFOLD;
+
+  /* all tokens before the first that may match end of string */
+  for (n = 0; !tk[n].zerotail && tk[n].op != OP_GLOBEND; n++);
+
+  memset(prog->lit, 0, prog->ntok);
+  memset(&prog->prefix, 0, sizeof prog->prefix);
+  prog->suffix = prog->infix = prog->prefix;
+  for (i = 0; i < n; i = j+1) {
+    for (j = i; j < n && ISBYTE(prog, &tk[j]); j++)
+      prog->lit[j] = (char) (fold ? lowercase[tk[j].c] : tk[j].c);
+    if (j == i) continue;
+    run.first = i;
+    run.len = j - i;
+    if (i == 0)
+      prog->prefix = run;
+    else if (j == n && tk[n].op == OP_END)
+      prog->suffix = run;
+    else if (run.len > prog->infix.len)
+      prog->infix = run;
+  }
 }
 
-/** return c with case (lower/upper) swapped */
+/** return the shape of prog: literal text only, literal text before
+    or after a star, or between two stars; else SHAPE_GENERAL */
 static int
-swapcase(int c)
+classify(const struct wildprog *prog)
 {
-  int lc = tolower(c);
-  return lc == c ? toupper(c) : lc;
+  const struct token *tk = prog->tok;
+  size_t n = prog->ntok - 1;  /* tokens before the end */
+  bool path = prog->flags & WILD_PATHNAME;
+
+  if (n == prog->prefix.len)
+    return SHAPE_LITERAL;
+  if (n == prog->prefix.len + 1 && tk[n-1].op == OP_STAR)
+    return SHAPE_PREFIX;
+  if (n == prog->suffix.len + 1 && tk[0].op == OP_STAR)
+    return SHAPE_SUFFIX;
+  /* with PATHNAME, a slash in the infix would split the stars' parts */
+  if (n == prog->infix.len + 2 && tk[0].op == OP_STAR && tk[n-1].op == OP_STAR &&
+      !(path && memchr(prog->lit + prog->infix.first, '/', prog->infix.len)))
+    return SHAPE_INFIX;
+  return SHAPE_GENERAL;
 }
 
-/** return true iff pat ends with slash-star-star or equivalent */
+/** translate pat (up to end) into tokens; only count them if prog
+    has no arrays */
+static void
+compile(struct wildprog *prog, const char *pat, const char *end, int flags)
+{
+  const char *pat0 = pat;
+  struct token *tk;
+  int pc, enc = FLAGENC(flags);
+  size_t n, i;
+  bool unifold, fold, path = flags & WILD_PATHNAME;
+
+  if (flags & WILD_UNIFOLD) flags |= WILD_CASEFOLD;
+  if (flags & WILD_BYTES) flags &= ~(WILD_UNIFOLD|WILD_STRICT);  /* no Unicode */
+  unifold = flags & WILD_UNIFOLD;
+  fold = flags & WILD_CASEFOLD;
+  prog->flags = flags;
+  prog->ntok = prog->nclass = prog->nrange = prog->nglob = 0;
+
+  for (;;) {
+    pc = nextchar(&pat, end, enc);
+    if (pc == 0) break;
+    if (pc == '*') {
+      if (pat < end && *pat == '*') {
+        const char *before = pat-2;
+        for (++pat; pat < end && *pat == '*'; pat++);
+        if (path && (before < pat0 || *before == '/') &&
+                    (pat == end || *pat == '/')) {
+          if (pat == end) {  /* trailing ** matches everything */
+            addtoken(prog, OP_GLOBEND, 0, 0);
+            break;
+          }
+          if (pat+1 < end) pat++;  /* skip non-trailing slash */
+          addtoken(prog, OP_GLOB, prog->nglob, 0);
+          continue;
+        }
+      }
+      addtoken(prog, OP_STAR, 0, 0);
+      continue;
+    }
+    if (pc == '[' && (n = scanbrack(pat, end)) > 0) {
+      addtoken(prog, OP_CLASS, prog->nclass, 0);
+      compbrack(prog, pat, end);
+      pat += n;
+      continue;
+    }
+    i = unifold ? orbit(pc) : 0;
+    if (i && foldstart[i+1] - foldstart[i] > 2) {  /* more than two cases */
+      addtoken(prog, OP_CLASS, prog->nclass, 0);
+      foldclass(prog, i);
+      continue;
+    }
+    if (pc == '?')
+      tk = addtoken(prog, OP_ANY, 0, 0);
+    else if (i)
+      tk = addtoken(prog, OP_LIT, pc, foldchar[foldstart[i]] == pc ?
+                    foldchar[foldstart[i]+1] : foldchar[foldstart[i]]);
+    else
+      tk = addtoken(prog, OP_LIT, pc, fold ? swapcase(pc) : pc);
+    if (!tk) continue;
+    tk->zerotail = isglobstar0(pc, pat, end);
+    if (pc == '.' && tk > prog->tok && tk[-1].op == OP_STAR)
+      tk[-1].dotnext = true;
+  }
+  addtoken(prog, OP_END, 0, 0);
+  if (prog->tok) {
+    findlits(prog);
+    prog->shape = classify(prog);
+    if ((flags & WILD_STRICT) && utf8check(pat0, end) == UTF8_INVALID)
+      prog->shape = SHAPE_NONE;
+  }
+}
+
+/** return true iff c matches the given cclass */
 static bool
-isglobstar0(int pc, const char *pat)
+inclass(const struct wildprog *prog, const struct cclass *cls, int c)
 {
-  if (pc != '/') return false;
-again:
-  if (*pat == '*') pat++; else return false;
-  if (*pat == '*') pat++; else return false;
-  for (; *pat; pat++) {
-    if (*pat == '/') { pat++; goto again; }
-    if (*pat != '*') return false;
+  const struct range *rng = prog->rng + cls->first;
+  size_t lo = 0, hi = cls->count;
+  STAT(classes);
+  if (c < 256)
+    return c >= 0 && GETBIT(cls->bits, c);
+  while (lo < hi) {  /* binary search */
+    size_t mid = lo + (hi - lo) / 2;
+    if (c < rng[mid].lo) hi = mid;
+    else if (c > rng[mid].hi) lo = mid + 1;
+    else return !cls->compl;
   }
-  return true;
+  return cls->compl;
 }
 
-/** return true iff sc+str is a dotfile (but not ./ nor ../) */
+/** return true iff string char sc matches the token (not a star) */
 static bool
-isdotfile(int sc, const char *str)
+matchtoken(const struct wildprog *prog, const struct token *tk, int sc)
 {
-  if (sc != '.') return false;
-  if (*str == '/') return false;
-  if (*str == '.' && str[1] == '/') return false;
-  return true;
+  switch (tk->op) {
+    case OP_LIT:
+      return tk->c == sc || tk->alt == sc;
+    case OP_ANY:
+      return true;
+    case OP_CLASS:
+      return inclass(prog, &prog->cls[tk->c], sc);
+  }
+  return false;
+}
+
+/** true iff token is the literal character ch */
+#define ISLIT(tk, ch) ((tk)->op == OP_LIT && (tk)->c == (ch))
+
+/* About bit-parallel matching
+ *
+ * Patterns of up to 64 tokens without an inner globstar are also
+ * compiled for bit-parallel matching (the Shift-And algorithm):
+ * each token is a bit of a machine word, and a bit is set while
+ * the string read so far may be matched up to and excluding that
+ * token. For each char 0..255 a mask tells which tokens consume
+ * it (with the rules for slashes and initial dots applied), so a
+ * char moves all set bits at once: a star keeps its bit, others
+ * shift it to the next token, and each star also sets the bit of
+ * the token after it. The string matches if at its end the bit of
+ * a token is set that may match the end (zerotail), or earlier if
+ * one is set that matches any rest (a trailing star without
+ * PATHNAME, or a trailing globstar). Matching takes a few machine
+ * instructions per char, without backtracking. Chars above 255
+ * (as in CJK text) are only tested against the tokens that may
+ * tell them apart: literals and classes. Only compiled
+ * patterns get the masks, as computing them would dominate the
+ * time of a single wildmatch() call.
+ *
+ * Shift-And reads every char, while backtracking skips to where
+ * the ASCII literal after a star may begin (see skipstar), a
+ * vector at a time. So a pattern with such a star (skip) is still
+ * backtracked on strings longer than SKIP_MIN bytes; on shorter
+ * ones the search has no room to pay off.
+ */
+
+#define SKIP_MIN 64
+
+/** return true iff token tk consumes char x (not a slash, not an
+    initial dot) in bit-parallel matching */
+#define CONSUMES(prog, tk, x) \
+  ((tk)->op == OP_STAR || ((tk)->op != OP_END && (tk)->op != OP_GLOBEND && \
+                           matchtoken(prog, tk, x)))
+
+/** return the mask of tokens that consume char x */
+static uint64_t
+charmask(const struct wildprog *prog, int x)
+{
+  const struct token *tk;
+  uint64_t m = 0, bit = 1;
+  bool path = prog->flags & WILD_PATHNAME;
+  for (tk = prog->tok; tk < prog->tok + prog->ntok; tk++, bit <<= 1) {
+    if (x == '/' && path ? ISLIT(tk, '/') : CONSUMES(prog, tk, x))
+      m |= bit;
+  }
+  return m;
+}
+
+/** return the mask of tokens that consume char x above 255 */
+static inline uint64_t
+himask(const struct wildprog *prog, int x)
+{
+  uint64_t m = prog->hiany, t, bit;
+  const struct token *tk = prog->tok;
+  for (t = prog->hitest, bit = 1; t; tk++, bit <<= 1) {
+    if (!(t & bit)) continue;
+    if (matchtoken(prog, tk, x)) m |= bit;
+    t &= ~bit;
+  }
+  return m;
+}
+
+/** compute masks for bit-parallel matching */
+static void
+compmasks(struct wildprog *prog)
+{
+  const struct token *tk;
+  uint64_t bit = 1;
+  bool rest = !(prog->flags & WILD_PATHNAME);
+  int c;
+
+  for (c = 0; c < 256; c++)
+    prog->mask[c] = charmask(prog, c);
+  prog->star = prog->tail = prog->all = prog->dot = 0;
+  prog->hiany = prog->hitest = 0;
+  prog->skip = false;
+  for (tk = prog->tok; tk < prog->tok + prog->ntok; tk++, bit <<= 1) {
+    if (tk->op == OP_STAR || tk->op == OP_ANY) prog->hiany |= bit;
+    if (tk->op == OP_CLASS || (tk->op == OP_LIT && (tk->c > 255 || tk->alt > 255)))
+      prog->hitest |= bit;
+    if (tk->op == OP_STAR) prog->star |= bit;
+    if (tk->op == OP_STAR && ISBYTE(prog, tk+1)) prog->skip = true;
+    if (tk->zerotail) prog->tail |= bit;
+    if (tk->op == OP_GLOBEND) prog->all |= bit;
+    if (ISLIT(tk, '.') || (tk->op == OP_STAR && tk->dotnext)) prog->dot |= bit;
+  }
+  /* trailing stars match any rest (but slashes with PATHNAME) */
+  for (bit >>= 2, tk = prog->tok + prog->ntok - 2;
+       rest && tk >= prog->tok && tk->op == OP_STAR; tk--, bit >>= 1)
+    prog->all |= bit;
+}
+
+#define ALIGNUP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/** compile pat (up to end) into mem if it fits in size bytes,
+    else into malloc'ed memory; with masks for bit-parallel matching
+    if bitpar and the pattern fits */
+static struct wildprog *
+build(void *mem, size_t size, const char *pat, const char *end, int flags,
+      bool bitpar)
+{
+  struct wildprog tmp, *prog;
+  size_t n, ntok, nclass, nrange, nmask;
+  char *p;
+
+  memset(&tmp, 0, sizeof tmp);
+  compile(&tmp, pat, end, flags);  /* count only */
+  ntok = tmp.ntok, nclass = tmp.nclass, nrange = tmp.nrange;
+  nmask = bitpar && ntok <= 64 && tmp.nglob == 0 ? 256 : 0;
+
+  n = ALIGNUP(sizeof *prog, sizeof(uint64_t)) + nmask * sizeof *prog->mask +
+      ntok * sizeof *prog->tok + nclass * sizeof *prog->cls +
+      nrange * sizeof *prog->rng + ntok;
+  if (n > size && !(mem = malloc(n))) return 0;
+
+  p = mem;
+  prog = (struct wildprog *) p;
+  p += ALIGNUP(sizeof *prog, sizeof(uint64_t));
+  prog->mask = nmask ? (uint64_t *) p : 0;
+  p += nmask * sizeof *prog->mask;
+  prog->cls = (struct cclass *) p;
+  p += nclass * sizeof *prog->cls;
+  prog->tok = (struct token *) p;
+  p += ntok * sizeof *prog->tok;
+  prog->rng = (struct range *) p;
+  p += nrange * sizeof *prog->rng;
+  prog->lit = p;
+
+  compile(prog, pat, end, flags);
+  if (prog->mask) compmasks(prog);
+  return prog;
+}
+
+/* About searching
+ *
+ * When the text after a star does not match, domatch() lets the
+ * star take one more character and tries again. If the text after
+ * the star begins with ASCII literals, all positions where those
+ * cannot begin are skipped at once with the search kernels below
+ * (and a trailing star takes the rest of the string at once):
+ * findbyte() finds the next of up to three bytes, and findpair()
+ * the next position with one of two bytes there and one of two
+ * other bytes a fixed distance later (the first and last char of
+ * the literal text, in either case). They compare 16 bytes at a
+ * time with SSE2, or 32 bytes with AVX2 if compiled for it (e.g.
+ * with -mavx2 or -march=native), and one byte at a time otherwise.
+ *
+ * Skipping is only done where it cannot change the result, that
+ * is, where each skipped try would fail at once and backtrack:
+ * with PATHNAME, only the first char is used and the search stops
+ * at a slash (which ends the star); without, the literal text
+ * is only used up to a token that may match the end of string.
+ */
+
+#if defined(__AVX2__)
+typedef __m256i vec;
+#define VECSIZE 32
+#define VLOAD(p) _mm256_loadu_si256((const __m256i *) (p))
+#define VSPLAT(c) _mm256_set1_epi8((char) (c))
+#define VEQ(v, w) _mm256_cmpeq_epi8(v, w)
+#define VOR(v, w) _mm256_or_si256(v, w)
+#define VAND(v, w) _mm256_and_si256(v, w)
+#define VMASK(v) ((uint32_t) _mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+typedef __m128i vec;
+#define VECSIZE 16
+#define VLOAD(p) _mm_loadu_si128((const __m128i *) (p))
+#define VSPLAT(c) _mm_set1_epi8((char) (c))
+#define VEQ(v, w) _mm_cmpeq_epi8(v, w)
+#define VOR(v, w) _mm_or_si128(v, w)
+#define VAND(v, w) _mm_and_si128(v, w)
+#define VMASK(v) ((uint32_t) _mm_movemask_epi8(v))
+#endif
+
+/** return first position in s..end with byte a, b, or c, else end */
+static const char *
+findbyte(const char *s, const char *end, int a, int b, int c)
+{
+#ifdef VECSIZE
+  if (end - s >= VECSIZE) {
+    vec va = VSPLAT(a), vb = VSPLAT(b), vc = VSPLAT(c);
+    for (; end - s >= VECSIZE; s += VECSIZE) {
+      vec v = VLOAD(s);
+      uint32_t m = VMASK(VOR(VOR(VEQ(v, va), VEQ(v, vb)), VEQ(v, vc)));
+      if (m) return s + __builtin_ctz(m);
+    }
+  }
+#endif
+  for (; s < end; s++) {
+    int x = (unsigned char) *s;
+    if (x == a || x == b || x == c) break;
+  }
+  return s;
+}
+
+/** return first position p in s..end with byte a0 or b0 at p[0]
+    and byte a1 or b1 at p[d] (before end), else end */
+static const char *
+findpair(const char *s, const char *end, int a0, int b0, int a1, int b1, size_t d)
+{
+  const char *last;
+  if ((size_t) (end - s) <= d) return end;
+  last = end - d;  /* p must be before last */
+#ifdef VECSIZE
+  if (last - s >= VECSIZE) {
+    vec va0 = VSPLAT(a0), vb0 = VSPLAT(b0), va1 = VSPLAT(a1), vb1 = VSPLAT(b1);
+    for (; last - s >= VECSIZE; s += VECSIZE) {
+      vec v = VLOAD(s), w = VLOAD(s + d);
+      uint32_t m = VMASK(VAND(VOR(VEQ(v, va0), VEQ(v, vb0)),
+                              VOR(VEQ(w, va1), VEQ(w, vb1))));
+      if (m) return s + __builtin_ctz(m);
+    }
+  }
+#endif
+  for (; s < last; s++) {
+    int x = (unsigned char) s[0], y;
+    if (a0 == b0) {
+      if (!(s = memchr(s, a0, last - s))) return end;
+    }
+    else if (x != a0 && x != b0)
+      continue;
+    y = (unsigned char) s[d];
+    if (y == a1 || y == b1) return s;
+  }
+  return end;
 }
 
-/** iterative wildcard matching; return true iff str matches pat */
+/** return the length of the well-formed UTF-8 sequence at s (before
+    end) of a char above 127, or 0 if ill-formed */
+static inline size_t
+utf8seq(const unsigned char *s, const unsigned char *end)
+{
+  unsigned c = s[0];
+  size_t n = end - s;
+  if (c < 0xE0) {  /* two bytes, but no continuation nor overlong */
+    return c >= 0xC2 && n >= 2 && (s[1] & 0xC0) == 0x80 ? 2 : 0;
+  }
+  if (c < 0xF0) {  /* three bytes, but no overlong nor surrogate */
+    if (n < 3 || (s[2] & 0xC0) != 0x80) return 0;
+    if (c == 0xE0) return s[1] >= 0xA0 && s[1] <= 0xBF ? 3 : 0;
+    if (c == 0xED) return s[1] >= 0x80 && s[1] <= 0x9F ? 3 : 0;
+    return (s[1] & 0xC0) == 0x80 ? 3 : 0;
+  }
+  /* four bytes, but no overlong nor beyond 0x10FFFF */
+  if (c > 0xF4 || n < 4 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80) return 0;
+  if (c == 0xF0) return s[1] >= 0x90 && s[1] <= 0xBF ? 4 : 0;
+  if (c == 0xF4) return s[1] >= 0x80 && s[1] <= 0x8F ? 4 : 0;
+  return (s[1] & 0xC0) == 0x80 ? 4 : 0;
+}
+
+/** return UTF8_ASCII if str..end has ASCII bytes (below 0x80) only,
+    else UTF8_VALID if it is well-formed UTF-8, else UTF8_INVALID */
 static int
-domatch(const char *pat, const char *str, int flags, int depth)
+utf8check(const char *str, const char *end)
 {
-  const char *p, *s, *t;
-  const char *pat0 = pat;
-  int pc, sc, folded, prev;
+  const unsigned char *s = (const unsigned char *) str;
+  const unsigned char *e = (const unsigned char *) end;
+  int enc = UTF8_ASCII;
   size_t n;
-  bool fold = flags & WILD_CASEFOLD;
-  bool path = flags & WILD_PATHNAME;
-  bool hidden = flags & WILD_PERIOD;
-  bool matchslash = false;
 
+  while (s < e) {
+    if (*s >= 0x80) {
+      if (!(n = utf8seq(s, e))) return UTF8_INVALID;
+      s += n;
+      enc = UTF8_VALID;
+      continue;
+    }
+#ifdef VECSIZE
+    /* skip ASCII, a vector at a time up to the next other char */
+    if (e - s >= VECSIZE) {
+      uint32_t m = VMASK(VLOAD(s));
+      if (m) {
+        s += __builtin_ctz(m);
+        continue;
+      }
+      for (s += VECSIZE; e - s >= 4*VECSIZE; s += 4*VECSIZE) {
+        vec v = VOR(VOR(VLOAD(s), VLOAD(s + VECSIZE)),
+                    VOR(VLOAD(s + 2*VECSIZE), VLOAD(s + 3*VECSIZE)));
+        if (VMASK(v)) break;  /* high bits set */
+      }
+      continue;
+    }
+#endif
+    s++;
+  }
+  return enc;
+}
+
+/** return first position in s..end where the text after a star
+    (at tk, an ASCII literal or the end) may begin, or a slash ends
+    the star */
+static const char *
+skipstar(const struct wildprog *prog, const struct token *tk,
+         const char *s, const char *end)
+{
+  size_t d = 0;
+  bool path = prog->flags & WILD_PATHNAME;
+  if (tk->op == OP_END)  /* trailing star */
+    return path ? findbyte(s, end, '/', '/', '/') : end;
+  if (s < end && ((unsigned char) *s == tk->c || (unsigned char) *s == tk->alt))
+    return s;  /* no need to search */
+  if (path)
+    return findbyte(s, end, tk->c, tk->alt, '/');
+  while (ISBYTE(prog, &tk[d+1]) && !tk[d+1].zerotail) d++;
+  return findpair(s, end, tk->c, tk->alt, tk[d].c, tk[d].alt, d);
+}
+
+/* About globstars
+ *
+ * At a globstar, the rest of the pattern is tried at the current
+ * position and then after each following slash, until it matches.
+ * This used to be done by recursion, which made patterns with many
+ * globstars take time exponential in their number (and needed a
+ * depth limit). Now each globstar that is being tried has a frame
+ * on an explicit stack: the rest of the pattern and the position
+ * where it is tried. If the rest fails, the innermost frame moves
+ * on to the next directory; if it runs out of directories, the try
+ * of the frame below fails, too (the rest of the pattern does not
+ * backtrack into a star before a globstar). A failed try is noted
+ * in a bitmap per globstar, indexed by string position, and never
+ * repeated, so each globstar tries each position at most once, and
+ * matching takes polynomial time for any number of globstars.
+ *
+ * Moreover, a frame is only given up after trying every directory
+ * that follows, and a globstar is only tried again after its frame
+ * has been given up. So when a globstar comes to a position noted
+ * as failed, all that follow have failed too, and it fails at once
+ * rather than skipping them one by one (which took time quadratic
+ * in the depth of the path).
+ */
+
+struct frame {
+  const struct token *pat;  /* rest of pattern after globstar */
+  const char *str;          /* where it is tried */
+  int glob;                 /* index of globstar */
+};
+
+/** iterative wildcard matching; return true iff str (up to end) matches
+    prog; enc tells the encoding of str (see utf8check); stack has room
+    for a frame per globstar, memo (if any) for a bit per globstar and
+    string position */
+static bool
+backtrack(const struct wildprog *prog, const char *str, const char *end,
+          int enc, struct frame *stack, uint64_t *memo)
+{
+  const struct token *pat = prog->tok, *p, *tk;
+  const char *base = str, *s, *t;
+  struct frame *f;
+  size_t sp = 0, words = (end - str + 63) / 64;
+  int sc, prev;
+  bool path = prog->flags & WILD_PATHNAME;
+  bool hidden = prog->flags & WILD_PERIOD;
+
+again:
   if (hidden) {
-    if (*str == '.' && *pat != '.' && isdotfile(*str, str+1))
-      return MISMATCH;
+    if (str < end && *str == '.' && !ISLIT(pat, '.') && isdotfile(*str, str+1, end))
+      goto fail;
   }
 
-  pc = sc = prev = 0;
-  p = s = 0;
+  sc = prev = 0;
+  p = 0; s = 0;
 
   for (;;) {
-    pc = utf8get(&pat);
-    if (pc == '*') {
-      if (*pat == '*') {
-        const char *before = pat-2;
-        for (++pat; *pat == '*'; pat++);
-        if (!path) matchslash = true;
-        else if ((before < pat0 || *before == '/') &&
-                 (*pat == 0 || *pat == '/')) {
-          if (*pat == 0) return MATCHED;  /* trailing ** matches everything */
-          if (pat[1]) pat++;  /* skip non-trailing slash */
-          if (depth >= RECURSION_LIMIT) return GIVEUP;
-          while (*str) {
-            int r = domatch(pat, str, flags, depth+1);
-            if (r == MATCHED) return MATCHED;
-            if (r == GIVEUP) return GIVEUP;
-            /* skip one directory and try again */
-            t = strchr(str+1, '/');
-            if (t) str = t[1] ? t+1 : t;  /* skip non-trailing slash */
-            else str += strlen(str);
-          }
-          return MISMATCH;
-        }
-        else matchslash = false;
-      }
-      else matchslash = path ? false : true;
+    STAT(steps);
+    tk = pat++;
+    if (tk->op == OP_STAR) {
       /* set anchor (commits previous wild star) */
       p = pat; s = str;
       continue;
     }
-    prev = sc;
-    sc = utf8get(&str);
-    if (sc == 0)
-      return pc == 0 || isglobstar0(pc, pat) ? MATCHED : MISMATCH;
-    if (sc == '/' && sc != pc && path && !matchslash)
-      return MISMATCH;  /* only a slash can match a slash */
-    if (sc == '.' && sc != pc && hidden && path && prev == '/' && isdotfile(sc, str))
-      return MISMATCH;  /* only a literal dot can match an initial dot */
-    folded = fold ? swapcase(sc) : sc;
-    if (pc == '[' && (n = scanbrack(pat)) > 0) {
-      if (matchbrack(pat, sc, folded)) pat += n;
-      else if (s && *s == '/' && path && !matchslash)
-        return MISMATCH;  /* cannot stretch across slash */
-      else if (!p) return MISMATCH;  /* no anchor to return */
-      else {
-        pat = p;
-        (void) utf8get(&s);
-        str = s;
-        prev = 0;
+    if (tk->op == OP_GLOBEND)
+      return true;  /* trailing ** matches everything */
+    if (tk->op == OP_GLOB) {
+      if (str >= end) goto fail;
+      if (memo && TESTPOS(memo + tk->c * words, str - base)) {
+        STAT(memohits);
+        goto fail;  /* and so will all that follow */
       }
-      continue;
+      STAT(globstars);
+      f = &stack[sp++];
+      STATMAX(maxdepth, sp);
+      f->pat = pat;
+      f->str = str;
+      f->glob = tk->c;
+      goto again;
+    }
+    prev = sc;
+    sc = nextchar(&str, end, enc);
+    if (sc == 0) {
+      if (tk->zerotail) return true;
+      goto fail;
     }
-    if (pc != '?' && pc != sc && pc != folded) {
-      if (s && *s == '/' && path && !matchslash)
-        return MISMATCH;  /* cannot stretch across slash */
-      if (!p) return MISMATCH;  /* no anchor to return */
+    if (sc == '/' && !ISLIT(tk, '/') && path)
+      goto fail;  /* only a slash can match a slash */
+    if (sc == '.' && !ISLIT(tk, '.') && hidden && path && prev == '/' && isdotfile(sc, str, end))
+      goto fail;  /* only a literal dot can match an initial dot */
+    if (!matchtoken(prog, tk, sc)) {
+      if (s && *s == '/' && path)
+        goto fail;  /* cannot stretch across slash */
+      if (!p) goto fail;  /* no anchor to return */
+      STAT(backtracks);
       pat = p;
-      (void) utf8get(&s);
+      (void) nextchar(&s, end, enc);
+      if (ISBYTE(prog, p) || p->op == OP_END)  /* skip where the star cannot end */
+        s = skipstar(prog, p, s, end);
       str = s;
       prev = 0;
-      continue;
     }
   }
+
+fail:
+  if (sp == 0) return false;
+  f = &stack[sp-1];
+  if (memo) SETPOS(memo + f->glob * words, f->str - base);
+  /* skip one directory and try again, unless known to fail from there */
+  STAT(steps);
+  t = memchr(f->str+1, '/', end - f->str - 1);
+  if (t) f->str = t+1 < end ? t+1 : t;  /* skip non-trailing slash */
+  else f->str = end;
+  if (f->str < end) {
+    if (!(memo && TESTPOS(memo + f->glob * words, f->str - base))) {
+      STAT(globstars);
+      pat = f->pat;
+      str = f->str;
+      goto again;
+    }
+    STAT(memohits);
+  }
+  sp--;  /* globstar exhausted */
+  goto fail;
 }
 
-int
-wildmatch(const char *pat, const char *str, int flags)
+/** return true iff str (up to end) matches prog (false if out of memory);
+    enc tells the encoding of str, or is UTF8_UNKNOWN */
+static bool
+domatch(const struct wildprog *prog, const char *str, const char *end, int enc)
 {
-  if (!pat || !str) return false;
-  return domatch(pat, str, flags, 0) == MATCHED;
+  union { struct frame f; uint64_t w; char buf[1024]; } mem;
+  size_t nglob = prog->nglob, words = (end - str + 63) / 64;
+  size_t n = nglob * sizeof(struct frame);
+  struct frame *stack = &mem.f;
+  uint64_t *memo = 0;
+  bool r;
+
+  /* with one globstar, no position is tried twice */
+  if (nglob > 1)
+    n = ALIGNUP(n, sizeof *memo) + nglob * words * sizeof *memo;
+  if (n > sizeof mem && !(stack = malloc(n))) {
+    STAT(giveups);
+    return false;
+  }
+  if (nglob > 1) {
+    memo = (uint64_t *) ((char *) stack + ALIGNUP(nglob * sizeof *stack, sizeof *memo));
+    memset(memo, 0, nglob * words * sizeof *memo);
+  }
+  if (enc == UTF8_UNKNOWN) enc = utf8check(str, end);
+  r = backtrack(prog, str, end, enc, stack, memo);
+  if (stack != &mem.f) free(stack);
+  return r;
+}
+
+/** return true iff the bytes at s are the literal text */
+static bool
+eqlit(const struct wildprog *prog, const struct literal *lit, const char *s)
+{
+  const unsigned char *t = (const unsigned char *) prog->lit + lit->first;
+  size_t i;
+  if (!(prog->flags & WILD_CASEFOLD))
+    return !memcmp(s, t, lit->len);
+  for (i = 0; i < lit->len; i++)
+    if (lowercase[(unsigned char) s[i]] != t[i]) return false;
+  return true;
+}
+
+/** return false if str (up to end) lacks required literal text */
+static bool
+prefilter(const struct wildprog *prog, const char *str, const char *end)
+{
+  const struct literal *lit = &prog->infix;
+  const struct token *tk;
+  const char *s;
+  size_t len = end - str, d;
+
+  if (prog->prefix.len + prog->suffix.len > len) return false;
+  if (!eqlit(prog, &prog->prefix, str)) return false;
+  if (!eqlit(prog, &prog->suffix, end - prog->suffix.len)) return false;
+  if (lit->len == 0) return true;
+
+  /* look for infix between prefix and suffix */
+  len -= prog->prefix.len + prog->suffix.len;
+  if (lit->len > len) return false;
+  s = str + prog->prefix.len;
+  end = s + len;
+  tk = prog->tok + lit->first;
+  d = lit->len - 1;
+  for (; (s = findpair(s, end, tk[0].c, tk[0].alt, tk[d].c, tk[d].alt, d)) < end; s++)
+    if (eqlit(prog, lit, s)) return true;
+  return false;
+}
+
+/** return true iff str (up to end) matches prog of a simple shape:
+    the literal text must be there, and what the stars take must not
+    have a slash (with PATHNAME) nor begin with an initial dot (with
+    PERIOD) */
+static bool
+matchshape(const struct wildprog *prog, const char *str, const char *end)
+{
+  const char *s = str, *t = end;  /* what the stars take */
+  size_t len = end - str;
+  bool path = prog->flags & WILD_PATHNAME;
+  bool hidden = prog->flags & WILD_PERIOD;
+
+  if (hidden) {
+    if (str < end && *str == '.' && !ISLIT(prog->tok, '.') && isdotfile(*str, str+1, end))
+      return false;
+  }
+  switch (prog->shape) {
+    case SHAPE_NONE:
+      return false;
+    case SHAPE_LITERAL:
+      return len == prog->prefix.len && eqlit(prog, &prog->prefix, str);
+    case SHAPE_PREFIX:
+      if (len < prog->prefix.len || !eqlit(prog, &prog->prefix, str)) return false;
+      s += prog->prefix.len;
+      if (hidden && path && s > str && s[-1] == '/' && s < end && isdotfile(*s, s+1, end))
+        return false;
+      break;
+    case SHAPE_SUFFIX:
+      if (len < prog->suffix.len) return false;
+      t -= prog->suffix.len;
+      if (!eqlit(prog, &prog->suffix, t)) return false;
+      break;
+    case SHAPE_INFIX:  /* no slash anywhere with PATHNAME */
+      if (path && memchr(str, '/', len)) return false;
+      return prefilter(prog, str, end);
+  }
+  return !path || !memchr(s, '/', t - s);
+}
+
+/** bit-parallel matching; return true iff str (up to end) matches prog;
+    enc tells the encoding of str, or is UTF8_UNKNOWN */
+static bool
+shiftand(const struct wildprog *prog, const char *str, const char *end, int enc)
+{
+  const char *s = str;
+  uint64_t d, m;
+  int x, prev = 0;
+  bool initdots = (prog->flags & WILD_PATHNAME) && (prog->flags & WILD_PERIOD);
+
+  if (prog->flags & WILD_PERIOD) {
+    if (str < end && *str == '.' && !ISLIT(prog->tok, '.') && isdotfile(*str, str+1, end))
+      return false;
+  }
+
+  d = 1 | (prog->star & 1) << 1;
+  while (s < end && d && !(d & prog->all)) {
+    x = (unsigned char) *s < 0x80 || enc == UTF8_ASCII ? (unsigned char) *s++ :
+        enc == UTF8_VALID ? utf8next(&s, end) : utf8get(&s, end);
+    m = x < 256 ? prog->mask[x] : himask(prog, x);
+    if (x == '.' && prev == '/' && initdots && isdotfile(x, s, end))
+      m &= prog->dot;  /* only a literal dot can match an initial dot */
+    d &= m;
+    d = (d & prog->star) | (d & ~prog->star) << 1;
+    d |= (d & prog->star) << 1;  /* stars never follow each other */
+    prev = x;
+  }
+  return (d & prog->all) || (s == end && (d & prog->tail));
+}
+
+/** return true iff str (up to end) matches compiled prog */
+static bool
+matchprog(const struct wildprog *prog, const char *str, const char *end)
+{
+  int enc = FLAGENC(prog->flags);
+  if ((prog->flags & WILD_STRICT) && (enc = utf8check(str, end)) == UTF8_INVALID)
+    return false;
+  if (prog->shape) return matchshape(prog, str, end);
+  if (!prefilter(prog, str, end)) return false;
+  if (prog->mask && !(prog->skip && end - str > SKIP_MIN))
+    return shiftand(prog, str, end, enc);
+  return domatch(prog, str, end, enc);
+}
+
+/** same as matchprog, counted as a call */
+static bool
+execute(const struct wildprog *prog, const char *str, const char *end)
+{
+  bool r;
+  STATBEGIN();
+  r = matchprog(prog, str, end);
+  STATEND();
+  return r;
+}
+
+/** return end of the string at s with at most n bytes: the first
+    NUL byte, if any, else s+n */
+static const char *
+strend(const char *s, size_t n)
+{
+  const char *t = memchr(s, 0, n);
+  return t ? t : s + n;
+}
+
+struct wildprog *
+wildmatch_compile(const char *pat, int flags)
+{
+  if (!pat) return 0;
+  return build(0, 0, pat, pat + strlen(pat), flags, true);
+}
+
+struct wildprog *
+wildmatch_compilen(const char *pat, size_t patlen, int flags)
+{
+  if (!pat) return 0;
+  return build(0, 0, pat, strend(pat, patlen), flags, true);
+}
+
+int
+wildmatch_exec(const struct wildprog *prog, const char *str)
+{
+  if (!prog || !str) return false;
+  return execute(prog, str, str + strlen(str));
+}
+
+int
+wildmatch_execn(const struct wildprog *prog, const char *str, size_t len)
+{
+  if (!prog || !str) return false;
+  return execute(prog, str, strend(str, len));
+}
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void) (p))
+#endif
+
+/* strings ahead to prefetch in a batch */
+#define PREFETCH_AHEAD 8
+
+size_t
+wildmatch_batch(const struct wildprog *prog, const char *const *strs,
+                size_t n, uint64_t *bits)
+{
+  size_t i, count = 0;
+  uint64_t word = 0;
+
+  if (!prog || !strs || !bits) return 0;
+  for (i = 0; i < n; i++) {
+    const char *str = strs[i];
+    if (i + PREFETCH_AHEAD < n && strs[i + PREFETCH_AHEAD])
+      PREFETCH(strs[i + PREFETCH_AHEAD]);
+    if (str && execute(prog, str, str + strlen(str))) {
+      word |= (uint64_t) 1 << (i & 63);
+      count++;
+    }
+    if ((i & 63) == 63) {
+      bits[i >> 6] = word;
+      word = 0;
+    }
+  }
+  if (n & 63) bits[n >> 6] = word;
+  return count;
+}
+
+void
+wildmatch_free(struct wildprog *prog)
+{
+  free(prog);
+}
+
+/* About thread pools
+ *
+ * A pool matches a batch of strings with several threads: the
+ * caller and the pool's helpers, which wait for work between
+ * batches. The strings are cut into blocks of 512, whose result
+ * bits make up one cache line of the bitmap, so threads never
+ * write to the same line (if the bitmap is aligned). Each thread
+ * starts with an equal range of blocks and takes chunks of an
+ * eighth of what is left from its front, so chunks get smaller
+ * towards the end; a thread that runs out steals the back half of
+ * another thread's range. This keeps all threads busy even if some
+ * strings take much longer to match than others. Each range has
+ * its own lock, which is held only to take or steal a chunk.
+ */
+
+#define POOL_BLOCK 512
+
+struct worker {
+  pthread_mutex_t lock;
+  size_t lo, hi;               /* blocks not yet taken */
+  size_t count;                /* matching strings */
+  struct wildpool *pool;
+  pthread_t thread;
+  char pad[64];                /* keep workers on separate cache lines */
+};
+
+struct wildpool {
+  int nthread;                 /* including the caller (worker 0) */
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  unsigned long gen;           /* number of batches started */
+  int busy;                    /* helpers still working on batch */
+  bool quit;
+  const struct wildprog *prog; /* the batch */
+  const char *const *strs;
+  size_t n;
+  uint64_t *bits;
+  struct worker *w;
+};
+
+/** take a chunk from the front of the worker's own range into lo..hi */
+static bool
+take(struct worker *w, size_t *lo, size_t *hi)
+{
+  bool r = false;
+  pthread_mutex_lock(&w->lock);
+  if (w->lo < w->hi) {
+    *lo = w->lo;
+    *hi = w->lo += (w->hi - w->lo + 7) / 8;
+    r = true;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return r;
+}
+
+/** move the back half of another worker's range to worker k */
+static bool
+steal(struct wildpool *pool, int k)
+{
+  int i;
+  for (i = 1; i < pool->nthread; i++) {
+    struct worker *v = &pool->w[(k + i) % pool->nthread];
+    size_t lo = 0, hi = 0;
+    pthread_mutex_lock(&v->lock);
+    if (v->lo < v->hi) {
+      hi = v->hi;
+      lo = v->hi -= (hi - v->lo + 1) / 2;
+    }
+    pthread_mutex_unlock(&v->lock);
+    if (lo < hi) {
+      pthread_mutex_lock(&pool->w[k].lock);
+      pool->w[k].lo = lo;
+      pool->w[k].hi = hi;
+      pthread_mutex_unlock(&pool->w[k].lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+/** match chunks of the current batch until none are left */
+static void
+work(struct wildpool *pool, int k)
+{
+  struct worker *w = &pool->w[k];
+  size_t lo, hi, first, last;
+  for (;;) {
+    if (!take(w, &lo, &hi)) {
+      if (steal(pool, k)) continue;
+      break;
+    }
+    first = lo * POOL_BLOCK;
+    last = hi * POOL_BLOCK < pool->n ? hi * POOL_BLOCK : pool->n;
+    w->count += wildmatch_batch(pool->prog, pool->strs + first,
+                                last - first, pool->bits + first / 64);
+  }
+}
+
+/** helper thread: work on each batch as it starts */
+static void *
+helper(void *arg)
+{
+  struct worker *w = arg;
+  struct wildpool *pool = w->pool;
+  unsigned long gen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->gen == gen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->quit) break;
+    gen = pool->gen;
+    pthread_mutex_unlock(&pool->lock);
+    work(pool, (int) (w - pool->w));
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+struct wildpool *
+wildpool_new(int nthreads)
+{
+  struct wildpool *pool;
+  int i;
+
+  if (nthreads <= 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = n > 0 ? (int) n : 1;
+  }
+  if (!(pool = calloc(1, sizeof *pool))) return 0;
+  if (!(pool->w = calloc(nthreads, sizeof *pool->w))) {
+    free(pool);
+    return 0;
+  }
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->start, 0);
+  pthread_cond_init(&pool->done, 0);
+  for (i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&pool->w[i].lock, 0);
+    pool->w[i].pool = pool;
+  }
+  /* the caller is worker 0; make do with fewer helpers if need be */
+  for (pool->nthread = 1; pool->nthread < nthreads; pool->nthread++)
+    if (pthread_create(&pool->w[pool->nthread].thread, 0, helper,
+                       &pool->w[pool->nthread]))
+      break;
+  return pool;
+}
+
+size_t
+wildpool_batch(struct wildpool *pool, const struct wildprog *prog,
+               const char *const *strs, size_t n, uint64_t *bits)
+{
+  size_t nblock = (n + POOL_BLOCK - 1) / POOL_BLOCK, count = 0;
+  size_t t;
+  int i;
+
+  if (!pool || !prog || !strs || !bits) return 0;
+  t = (size_t) pool->nthread;
+  for (i = 0; i < pool->nthread; i++) {
+    pool->w[i].lo = nblock * i / t;
+    pool->w[i].hi = nblock * (i+1) / t;
+    pool->w[i].count = 0;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->prog = prog;
+  pool->strs = strs;
+  pool->n = n;
+  pool->bits = bits;
+  pool->busy = pool->nthread - 1;
+  pool->gen++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  work(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->nthread; i++)
+    count += pool->w[i].count;
+  return count;
+}
+
+void
+wildpool_free(struct wildpool *pool)
+{
+  int i;
+  if (!pool) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 1; i < pool->nthread; i++)
+    pthread_join(pool->w[i].thread, 0);
+  for (i = 0; i < pool->nthread; i++)
+    pthread_mutex_destroy(&pool->w[i].lock);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->w);
+  free(pool);
+}
+
+/* About matching without compiling
+ *
+ * A single call of wildmatch would spend more time compiling the
+ * pattern than matching it, as most strings are told apart from
+ * the pattern by their first few chars. So wildmatch interprets
+ * the pattern text as it goes: each token is decoded from the
+ * pattern when it is reached, a class is tested by scanning its
+ * text, and otherwise matching is done as by backtrack, with the
+ * same results. Only a single globstar can be tried without the
+ * memo, and case orbits need the tables built when compiling, so
+ * a pattern with several globstars or UNIFOLD is compiled, as is
+ * one matched against a long string, where compiling takes little
+ * time compared to matching and its literal checks may pay off.
+ * Before all that, the first bytes of pattern and string alone
+ * reject most strings that start with another ASCII char.
+ */
+
+#define DIRECT_MAX 256  /* longest string matched without compiling */
+
+/* decoding a token is on the hot path: the compiler must not call it */
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/** a token decoded from the pattern text */
+struct ptoken {
+  int op, c, alt;       /* as in struct token */
+  bool zerotail;
+  const char *cls;      /* OP_CLASS: text after the opening bracket */
+  const char *next;     /* pattern text after the token */
+};
+
+/** true iff token is a literal that is a single byte in the string */
+#define PTBYTE(tk, bytes) ((tk)->op == OP_LIT && \
+  (((tk)->c < 128 && (tk)->alt < 128) || (bytes)))
+
+/** return the char at *p of the pattern (up to end) and increment *p,
+    or return 0 if *p is at end */
+static inline int
+patchar(const char **pp, const char *end, bool bytes)
+{
+  if (*pp >= end) return 0;
+  if (bytes || (unsigned char) **pp < 0x80) return (unsigned char) *(*pp)++;
+  return utf8decode(pp, end);
+}
+
+/** return the char at *p of the string (up to end) and increment *p,
+    or return 0 if *p is at end; a well-formed sequence not followed
+    by stray continuation bytes is decoded the quick way */
+static inline int
+strchar(const char **pp, const char *end, bool bytes)
+{
+  const unsigned char *s = (const unsigned char *) *pp;
+  const unsigned char *e = (const unsigned char *) end;
+  size_t n;
+  if (s >= e) return 0;
+  if (bytes || *s < 0x80) return (unsigned char) *(*pp)++;
+  if ((n = utf8seq(s, e)) && (s + n == e || (s[n] & 0xC0) != 0x80))
+    return utf8next(pp, end);
+  return utf8get(pp, end);
+}
+
+/** decode the token at pat (up to end) of the pattern starting at
+    pat0 into tk, the same as compile would with flags (no UNIFOLD) */
+static ALWAYS_INLINE void
+pattoken(const char *pat0, const char *pat, const char *end, int flags,
+         struct ptoken *tk)
+{
+  bool bytes = flags & WILD_BYTES, path = flags & WILD_PATHNAME;
+  int pc = patchar(&pat, end, bytes);
+  size_t n;
+
+  tk->c = tk->alt = 0;
+  tk->zerotail = false;
+  tk->cls = 0;
+  if (pc == 0) {
+    tk->op = OP_END;
+    tk->zerotail = true;
+  }
+  else if (pc == '*') {
+    tk->op = OP_STAR;
+    if (pat < end && *pat == '*') {
+      const char *before = pat-2;
+      for (++pat; pat < end && *pat == '*'; pat++);
+      if (path && (before < pat0 || *before == '/') &&
+                  (pat == end || *pat == '/')) {
+        tk->op = pat == end ? OP_GLOBEND : OP_GLOB;
+        if (pat+1 < end) pat++;  /* skip non-trailing slash */
+      }
+    }
+  }
+  else if (pc == '[' && (n = scanbrack(pat, end)) > 0) {
+    tk->op = OP_CLASS;
+    tk->cls = pat;
+    pat += n;
+  }
+  else if (pc == '?')
+    tk->op = OP_ANY;
+  else {
+    tk->op = OP_LIT;
+    tk->c = pc;
+    tk->alt = flags & WILD_CASEFOLD ? swapcase(pc) : pc;
+    tk->zerotail = isglobstar0(pc, pat, end);
+  }
+  tk->next = pat;
+}
+
+/** true iff sc, or its other case with fold, is in lo..hi (as set in
+    the bitmap of a class by addrange) */
+#define INRANGE(lo, hi, sc, fold) (((lo) <= (sc) && (sc) <= (hi)) || \
+  ((fold) && (sc) < 256 && (lo) <= swapcase(sc) && swapcase(sc) <= (hi)))
+
+/** return true iff string char sc matches the class at pat (after
+    the opening bracket), the same as the cclass compbrack makes */
+static bool
+textclass(const char *pat, const char *end, int flags, int sc)
+{
+  bool bytes = flags & WILD_BYTES, fold = flags & WILD_CASEFOLD;
+  bool compl = false, hit = false;
+  int pc;
+  STAT(classes);
+  if (*pat == '!' || *pat == '^') {
+    compl = true;
+    pat++;
+  }
+  if (*pat == ']' || *pat == '-') {
+    hit = INRANGE(*pat, *pat, sc, fold);
+    pat++;
+  }
+  for (pc = pat[-1]; !hit && *pat != ']'; ) {
+    if (pat[0] == '-' && pat[1] != ']') {
+      int hi;
+      pat++; /* skip the dash */
+      hi = patchar(&pat, end, bytes);
+      hit = INRANGE(pc, hi, sc, fold);
+    }
+    else {
+      pc = patchar(&pat, end, bytes);
+      hit = INRANGE(pc, pc, sc, fold);
+    }
+  }
+  return hit != compl;
+}
+
+/** return true iff string char sc matches the token (not a star) */
+static bool
+matchptoken(const struct ptoken *tk, const char *end, int flags, int sc)
+{
+  switch (tk->op) {
+    case OP_LIT:
+      return tk->c == sc || tk->alt == sc;
+    case OP_ANY:
+      return true;
+    case OP_CLASS:
+      return textclass(tk->cls, end, flags, sc);
+  }
+  return false;
+}
+
+/** the token after a star and the run of single byte literals it
+    starts, as needed by skiptext */
+struct anchor {
+  struct ptoken tk;
+  const struct ptoken *last;  /* last of the run, or null if not known */
+  struct ptoken next;         /* holds it if not tk */
+  size_t d;                   /* distance to it */
+};
+
+/** same as skipstar for the token a->tk of the pattern text pat0 (up
+    to pend) */
+static const char *
+skiptext(const char *pat0, const char *pend, int flags, struct anchor *a,
+         const char *s, const char *end)
+{
+  const struct ptoken *tk = &a->tk;
+  struct ptoken next;
+  bool bytes = flags & WILD_BYTES, path = flags & WILD_PATHNAME;
+  if (tk->op == OP_END)  /* trailing star */
+    return path ? findbyte(s, end, '/', '/', '/') : end;
+  if (!PTBYTE(tk, bytes))
+    return s;
+  if (s < end && ((unsigned char) *s == tk->c || (unsigned char) *s == tk->alt))
+    return s;  /* no need to search */
+  if (path)
+    return findbyte(s, end, tk->c, tk->alt, '/');
+  if (!a->last) {
+    for (a->last = tk, a->d = 0; ; a->d++) {
+      pattoken(pat0, a->last->next, pend, flags, &next);
+      if (!PTBYTE(&next, bytes) || next.zerotail) break;
+      a->next = next;
+      a->last = &a->next;
+    }
+  }
+  return findpair(s, end, tk->c, tk->alt, a->last->c, a->last->alt, a->d);
+}
+
+/** same as backtrack for the pattern text pat0 (up to pend) with at
+    most one globstar and flags without UNIFOLD */
+static bool
+interpret(const char *pat0, const char *pend, const char *str,
+          const char *end, int flags)
+{
+  struct ptoken tk;
+  struct anchor a;
+  const char *pat = pat0, *p, *s, *t;
+  const char *fpat = 0, *fstr = 0;  /* the frame of the globstar */
+  int sc, prev;
+  bool bytes = flags & WILD_BYTES;
+  bool path = flags & WILD_PATHNAME;
+  bool hidden = flags & WILD_PERIOD;
+
+again:
+  if (hidden) {
+    if (str < end && *str == '.' && !(pat < pend && *pat == '.') &&
+        isdotfile(*str, str+1, end))
+      goto fail;
+  }
+
+  sc = prev = 0;
+  p = 0; s = 0;
+
+  for (;;) {
+    STAT(steps);
+    if (pat == p)
+      tk = a.tk;  /* decoded with the anchor */
+    else
+      pattoken(pat0, pat, pend, flags, &tk);
+    pat = tk.next;
+    if (tk.op == OP_STAR) {
+      /* set anchor (commits previous wild star) */
+      p = pat; s = str;
+      pattoken(pat0, p, pend, flags, &a.tk);
+      a.last = 0;
+      continue;
+    }
+    if (tk.op == OP_GLOBEND)
+      return true;  /* trailing ** matches everything */
+    if (tk.op == OP_GLOB) {
+      if (str >= end) goto fail;
+      STAT(globstars);
+      STATMAX(maxdepth, 1);
+      fpat = pat;
+      fstr = str;
+      goto again;
+    }
+    prev = sc;
+    sc = strchar(&str, end, bytes);
+    if (sc == 0) {
+      if (tk.zerotail) return true;
+      goto fail;
+    }
+    if (sc == '/' && !(tk.op == OP_LIT && tk.c == '/') && path)
+      goto fail;  /* only a slash can match a slash */
+    if (sc == '.' && !(tk.op == OP_LIT && tk.c == '.') && hidden && path &&
+        prev == '/' && isdotfile(sc, str, end))
+      goto fail;  /* only a literal dot can match an initial dot */
+    if (!matchptoken(&tk, pend, flags, sc)) {
+      if (s && *s == '/' && path)
+        goto fail;  /* cannot stretch across slash */
+      if (!p) goto fail;  /* no anchor to return */
+      STAT(backtracks);
+      pat = p;
+      (void) strchar(&s, end, bytes);
+      s = skiptext(pat0, pend, flags, &a, s, end);
+      str = s;
+      prev = 0;
+    }
+  }
+
+fail:
+  if (!fpat) return false;
+  /* skip one directory and try again */
+  STAT(steps);
+  t = memchr(fstr+1, '/', end - fstr - 1);
+  if (t) fstr = t+1 < end ? t+1 : t;  /* skip non-trailing slash */
+  else fstr = end;
+  if (fstr < end) {
+    STAT(globstars);
+    pat = fpat;
+    str = fstr;
+    goto again;
+  }
+  return false;  /* globstar exhausted */
+}
+
+/** return true iff pat (up to end) has more than one run of stars
+    that may be a globstar */
+static bool
+manyglobs(const char *pat, const char *end)
+{
+  const char *s = pat, *t;
+  int n = 0;
+  while ((t = memchr(s, '*', end - s))) {
+    for (s = t; s < end && *s == '*'; s++);
+    if (s - t > 1 && ++n > 1) return true;
+  }
+  return false;
+}
+
+/** match str (up to send) against pat (up to pend) */
+static int
+matchslice(const char *pat, const char *pend,
+           const char *str, const char *send, int flags)
+{
+  union { struct wildprog prog; size_t align; char buf[1024]; } mem;
+  struct wildprog *prog;
+  int r;
+  if (flags & WILD_UNIFOLD) flags |= WILD_CASEFOLD;
+  if (flags & WILD_BYTES) flags &= ~(WILD_UNIFOLD|WILD_STRICT);  /* no Unicode */
+  if (!(flags & WILD_UNIFOLD) && send - str <= DIRECT_MAX &&
+      !((flags & WILD_PATHNAME) && manyglobs(pat, pend))) {
+    STATBEGIN();
+    r = !((flags & WILD_STRICT) && (utf8check(pat, pend) == UTF8_INVALID ||
+                                    utf8check(str, send) == UTF8_INVALID)) &&
+        interpret(pat, pend, str, send, flags);
+    STATEND();
+    return r;
+  }
+  if (!(prog = build(&mem, sizeof mem, pat, pend, flags, false))) return false;
+  r = execute(prog, str, send);
+  if (prog != &mem.prog) free(prog);
+  return r;
+}
+
+/** return true iff the first bytes of pat and str tell a mismatch:
+    an ASCII literal that str does not start with (either case with
+    CASEFOLD or UNIFOLD, as an ASCII char folds to ASCII only) */
+static bool
+firstmiss(const char *pat, const char *str, int flags)
+{
+  int pc = (unsigned char) *pat, sc = (unsigned char) *str;
+  if (pc == 0 || pc >= 0x80 || sc == 0 || sc >= 0x80 || pc == sc)
+    return false;
+  if (pc == '*' || pc == '?' || pc == '[' || pc == '/')
+    return false;
+  return !(flags & (WILD_CASEFOLD|WILD_UNIFOLD)) || swapcase(pc) != sc;
+}
+
+int
+wildmatch(const char *pat, const char *str, int flags)
+{
+  if (!pat || !str) return false;
+  if (firstmiss(pat, str, flags)) return false;
+  return matchslice(pat, pat + strlen(pat), str, str + strlen(str), flags);
+}
+
+int
+wildmatchn(const char *pat, size_t patlen, const char *str, size_t len, int flags)
+{
+  if (!pat || !str) return false;
+  if (patlen && len && firstmiss(pat, str, flags)) return false;
+  return matchslice(pat, strend(pat, patlen), str, strend(str, len), flags);
+}
+
+/* About the automaton
+ *
+ * Matching many patterns at once is done with a nondeterministic
+ * automaton whose states are pattern tokens: a state is active if
+ * the string read so far may be matched up to and excluding that
+ * token. Patterns (with the same flags) that begin with the same
+ * tokens share these states, so the automaton is a tree (a trie)
+ * of tokens, rooted at a state that precedes all first tokens.
+ * Each string character is decoded once and moves all active states
+ * forward together; a pattern matches if a state accepting for it
+ * is active at the end of the string.
+ *
+ * A star is a state that loops on every character it may match.
+ * A globstar is three states: GLOB just offered the remainder of
+ * the pattern at the current position and skips one character,
+ * SCAN then looks for the next slash, and WAIT offers the rest of
+ * the pattern after that slash (once the next character is known,
+ * because an initial dot needs special treatment). These follow
+ * exactly the directories that domatch() tries. A trailing
+ * globstar matches at once.
+ *
+ * The rules for slashes (PATHNAME) and initial dots (PERIOD) are
+ * the same as in domatch(): a slash is only matched by a literal
+ * slash, a dot at the start of a path component only by a literal
+ * dot (or by a star immediately followed by a literal dot, as the
+ * star may then stretch over it), and a pattern (or what follows
+ * a globstar) must begin with a literal dot to match a leading dot.
+ */
+
+enum { NS_ROOT, NS_LIT, NS_ANY, NS_CLASS, NS_STAR, NS_END, NS_ALL,
+       NS_GLOB, NS_SCAN, NS_WAIT };
+
+struct nstate {
+  unsigned char op;
+  bool path, hidden;           /* PATHNAME and PERIOD of the patterns */
+  int child, sibling;          /* first following state, next sibling */
+  int aux;                     /* GLOB: its SCAN; SCAN and WAIT: the GLOB */
+  int accept;                  /* patterns accepting here, or -1 */
+  const struct wildprog *prog;
+  const struct token *tk;
+};
+
+struct naccept {
+  int pid, next;
+  int flags;                   /* of the pattern */
+};
+
+struct nfa {
+  size_t nstate, npat, naccept;
+  struct nstate *st;           /* st[0] is the root */
+  struct naccept *acc;         /* lists of accepting patterns */
+};
+
+/* scratch space for running an automaton */
+struct nrun {
+  int *cur, *next;             /* lists of active states */
+  size_t ncur, nnext;
+  int *stack;                  /* states to be activated */
+  size_t sp;
+  unsigned long *mark;         /* mark[s] == gen iff s in current list */
+  unsigned long gen;
+  int *hits;                   /* matching pattern indices */
+  size_t nhit;
+  unsigned long *hitmark;      /* hitmark[pid] == hitgen iff pid in hits */
+  unsigned long hitgen;
+  bool invalid;                /* string is ill-formed UTF-8 */
+  bool decoded;                /* string was decoded (and is not ASCII) */
+};
+
+/** return upper bound on number of automaton states added for prog */
+static size_t
+nfasize(const struct wildprog *prog)
+{
+  return prog->ntok + 2 * prog->nglob;
+}
+
+/** return true iff the two classes contain the same characters */
+static bool
+sameclass(const struct wildprog *p, const struct cclass *a,
+          const struct wildprog *q, const struct cclass *b)
+{
+  return a->compl == b->compl && a->count == b->count &&
+         !memcmp(a->bits, b->bits, sizeof a->bits) &&
+         !memcmp(p->rng + a->first, q->rng + b->first, a->count * sizeof *p->rng);
+}
+
+/** return true iff state st can be shared by token tk of prog */
+static bool
+sametoken(const struct nstate *st, const struct wildprog *prog, const struct token *tk)
+{
+  const struct token *sk = st->tk;
+  if (st->path != !!(prog->flags & WILD_PATHNAME)) return false;
+  if (st->hidden != !!(prog->flags & WILD_PERIOD)) return false;
+  if (sk->op != tk->op || sk->zerotail != tk->zerotail) return false;
+  if (sk->dotnext != tk->dotnext) return false;
+  if (sk->op == OP_LIT) return sk->c == tk->c && sk->alt == tk->alt;
+  if (sk->op == OP_CLASS)
+    return sameclass(st->prog, &st->prog->cls[sk->c], prog, &prog->cls[tk->c]);
+  return true;
+}
+
+/** append state for token tk of prog after state s, return its index */
+static int
+nfanew(struct nfa *nfa, int s, const struct wildprog *prog, const struct token *tk)
+{
+  static const unsigned char ops[] = {
+    NS_END, NS_LIT, NS_ANY, NS_CLASS, NS_STAR, NS_GLOB, NS_ALL };
+  int t = (int) nfa->nstate++;
+  struct nstate *st = &nfa->st[t];
+  st->op = ops[tk->op];
+  st->path = prog->flags & WILD_PATHNAME;
+  st->hidden = prog->flags & WILD_PERIOD;
+  st->child = -1;
+  st->sibling = nfa->st[s].child;
+  st->aux = 0;
+  st->accept = -1;
+  st->prog = prog;
+  st->tk = tk;
+  nfa->st[s].child = t;
+  if (st->op == NS_GLOB) {
+    st->aux = (int) nfa->nstate;
+    st[1] = st[2] = *st;
+    st[1].op = NS_SCAN;
+    st[2].op = NS_WAIT;
+    st[1].aux = st[2].aux = t;
+    st[1].sibling = st[2].sibling = -1;
+    nfa->nstate += 2;
+  }
+  return t;
+}
+
+/** note that pattern pid (with flags) accepts in state s */
+static void
+nfaaccept(struct nfa *nfa, int s, int pid, int flags)
+{
+  nfa->acc[nfa->naccept].pid = pid;
+  nfa->acc[nfa->naccept].flags = flags;
+  nfa->acc[nfa->naccept].next = nfa->st[s].accept;
+  nfa->st[s].accept = (int) nfa->naccept++;
+}
+
+/** add prog to the automaton (st and acc must have room) */
+static void
+nfainsert(struct nfa *nfa, const struct wildprog *prog)
+{
+  const struct token *tk;
+  int s = 0, t;
+  int pid = (int) nfa->npat++;
+
+  if (nfa->nstate == 0) {  /* create root */
+    memset(&nfa->st[0], 0, sizeof nfa->st[0]);
+    nfa->st[0].op = NS_ROOT;
+    nfa->st[0].child = nfa->st[0].sibling = nfa->st[0].accept = -1;
+    nfa->nstate = 1;
+  }
+  for (tk = prog->tok; ; tk++) {
+    for (t = nfa->st[s].child; t >= 0; t = nfa->st[t].sibling)
+      if (sametoken(&nfa->st[t], prog, tk)) break;
+    s = t >= 0 ? t : nfanew(nfa, s, prog, tk);
+    if (tk->zerotail || tk->op == OP_GLOBEND)
+      nfaaccept(nfa, s, pid, prog->flags);
+    if (tk->op == OP_END || tk->op == OP_GLOBEND)
+      break;
+  }
+}
+
+/** note that pattern pid matches */
+static void
+nfahit(struct nrun *run, int pid)
+{
+  if (run->hitmark[pid] == run->hitgen) return;
+  run->hitmark[pid] = run->hitgen;
+  run->hits[run->nhit++] = pid;
+}
+
+/** note that all patterns accepting in state s match (but those with
+    STRICT if the string is ill-formed, and those with BYTES if it was
+    decoded) */
+static void
+nfahits(const struct nfa *nfa, struct nrun *run, int s)
+{
+  int a, f;
+  for (a = nfa->st[s].accept; a >= 0; a = nfa->acc[a].next) {
+    f = nfa->acc[a].flags;
+    if ((f & WILD_BYTES) ? !run->decoded : !(run->invalid && (f & WILD_STRICT)))
+      nfahit(run, nfa->acc[a].pid);
+  }
+}
+
+/** push the states following s (after a globstar or at the root,
+    only those that can match a leading dot if dot) */
+static void
+nfapush(const struct nfa *nfa, struct nrun *run, int s, bool dot)
+{
+  const struct nstate *st = &nfa->st[s];
+  for (s = st->child; s >= 0; s = nfa->st[s].sibling) {
+    if (dot && nfa->st[s].hidden && !ISLIT(nfa->st[s].tk, '.'))
+      continue;  /* only a literal dot can match a leading dot */
+    run->stack[run->sp++] = s;
+  }
+}
+
+/** activate pushed states and the states reachable from them without
+    reading a char; x is the next char and dot if it is a dot that
+    starts a dotfile, or x is -1 if not yet known */
+static void
+nfaclose(const struct nfa *nfa, struct nrun *run, int *list, size_t *n,
+         int x, bool dot)
+{
+  while (run->sp > 0) {
+    int s = run->stack[--run->sp];
+    const struct nstate *st = &nfa->st[s];
+    if (st->op == NS_GLOB && x < 0) {
+      s = st->aux + 1;  /* wait for the next char */
+      st = &nfa->st[s];
+    }
+    if (run->mark[s] == run->gen) continue;
+    run->mark[s] = run->gen;
+    if (st->op == NS_ALL) {
+      nfahits(nfa, run, s);  /* trailing ** matches everything */
+      continue;
+    }
+    list[(*n)++] = s;
+    if (st->op == NS_STAR)
+      nfapush(nfa, run, s, false);
+    else if (st->op == NS_GLOB)  /* offer remainder of pattern here */
+      nfapush(nfa, run, s, dot);
+  }
+}
+
+/** return true iff state st may consume char x */
+static bool
+nfaconsume(const struct nstate *st, int x, bool initdot)
+{
+  if (x == '/' && st->path && !ISLIT(st->tk, '/'))
+    return false;  /* only a slash can match a slash */
+  if (initdot && st->path && st->hidden && !ISLIT(st->tk, '.'))
+    return false;  /* only a literal dot can match an initial dot */
+  return st->op == NS_STAR || matchtoken(st->prog, st->tk, x);
+}
+
+/** advance all active states over char x; last iff x is the last char,
+    dot iff x is a dot that starts a dotfile, prev is the previous char */
+static void
+nfastep(const struct nfa *nfa, struct nrun *run, int x, bool last, bool dot, int prev)
+{
+  size_t i, n;
+  int *tmp;
+  bool initdot = dot && prev == '/';
+
+  /* waiting globstars now know the next char */
+  for (i = 0, n = run->ncur; i < n; i++) {
+    const struct nstate *st = &nfa->st[run->cur[i]];
+    if (st->op == NS_WAIT)
+      run->stack[run->sp++] = st->aux;
+    else if (st->op == NS_SCAN && x == '/' && last)  /* trailing slash */
+      nfapush(nfa, run, st->aux, false);
+    nfaclose(nfa, run, run->cur, &run->ncur, x, dot);
+  }
+
+  run->gen++;
+  run->nnext = 0;
+  for (i = 0; i < run->ncur; i++) {
+    int s = run->cur[i];
+    const struct nstate *st = &nfa->st[s];
+    switch (st->op) {
+      case NS_LIT: case NS_ANY: case NS_CLASS:
+        if (nfaconsume(st, x, initdot))
+          nfapush(nfa, run, s, false);
+        break;
+      case NS_STAR:  /* may stretch over an initial dot if a dot follows */
+        if (nfaconsume(st, x, initdot && !st->tk->dotnext))
+          run->stack[run->sp++] = s;
+        break;
+      case NS_GLOB:  /* skip one char, then scan */
+        run->stack[run->sp++] = st->aux;
+        break;
+      case NS_SCAN:
+        if (x != '/')
+          run->stack[run->sp++] = s;
+        else if (!last)
+          run->stack[run->sp++] = st->aux;
+        break;
+    }
+    nfaclose(nfa, run, run->next, &run->nnext, -1, false);
+  }
+
+  tmp = run->cur; run->cur = run->next; run->next = tmp;
+  run->ncur = run->nnext;
+}
+
+/** run automaton over str (up to end), collecting matching patterns
+    in run->hits; stop at the first match if any is true; take a char
+    per byte if bytes */
+static void
+nfarun(const struct nfa *nfa, struct nrun *run, const char *str,
+       const char *end, bool any, bool bytes)
+{
+  const char *t = str;
+  size_t i;
+  int x, prev = 0, enc = bytes ? UTF8_ASCII : utf8check(str, end);
+  bool dot;
+
+  run->invalid = enc == UTF8_INVALID;
+  run->decoded = enc != UTF8_ASCII;
+  run->nhit = 0;
+  run->hitgen++;
+  run->gen++;
+  run->ncur = 0;
+  if (nfa->nstate == 0) return;
+
+  x = nextchar(&t, end, enc);
+  dot = x == '.' && isdotfile(x, t, end);
+  nfapush(nfa, run, 0, dot);
+  nfaclose(nfa, run, run->cur, &run->ncur, x ? x : -1, dot);
+
+  while (x && run->ncur > 0 && !(any && run->nhit)) {
+    nfastep(nfa, run, x, t == end, dot, prev);
+    prev = x;
+    x = nextchar(&t, end, enc);
+    dot = x == '.' && isdotfile(x, t, end);
+  }
+
+  if (x == 0) {
+    for (i = 0; i < run->ncur; i++)
+      nfahits(nfa, run, run->cur[i]);
+  }
+}
+
+enum { PREFIX_NO, PREFIX_MAYBE, PREFIX_ALWAYS };
+
+/** run automaton over str (up to end), the beginning of longer strings,
+    decoded as for flags; return PREFIX_NO if none of them can match,
+    PREFIX_ALWAYS if a pattern matches all of them, else PREFIX_MAYBE */
+static int
+nfaprefix(const struct nfa *nfa, struct nrun *run, const char *str,
+          const char *end, int flags)
+{
+  const char *t = str;
+  int x, prev = 0, enc = FLAGENC(flags);
+  bool dot;
+
+  run->invalid = run->decoded = false;
+  run->nhit = 0;
+  run->hitgen++;
+  run->gen++;
+  run->ncur = 0;
+  if (nfa->nstate == 0) return PREFIX_NO;
+
+  x = nextchar(&t, end, enc);
+  dot = x == '.' && isdotfile(x, t, end);
+  nfapush(nfa, run, 0, dot);
+  nfaclose(nfa, run, run->cur, &run->ncur, x ? x : -1, dot);
+
+  while (x && run->ncur > 0 && !run->nhit) {
+    nfastep(nfa, run, x, false, dot, prev);
+    prev = x;
+    x = nextchar(&t, end, enc);
+    dot = x == '.' && isdotfile(x, t, end);
+  }
+
+  if (run->nhit) return PREFIX_ALWAYS;  /* reached a trailing globstar */
+  if (x == 0 && t > str) {
+    size_t i;
+    for (i = 0; i < run->ncur; i++) {
+      const struct nstate *st = &nfa->st[run->cur[i]];
+      if (st->op == NS_STAR && !st->path && st->tk[1].op == OP_END)
+        return PREFIX_ALWAYS;  /* reached a trailing star without PATHNAME */
+    }
+  }
+  return run->ncur > 0 ? PREFIX_MAYBE : PREFIX_NO;
+}
+
+/* About pattern sets
+ *
+ * A set collects patterns (each with its own flags) into one
+ * automaton that is run once over a string to find all matching
+ * patterns. Patterns are identified by the order they were added,
+ * starting at 0. States and scratch space grow as patterns are
+ * added, so matching never allocates; but because of the scratch
+ * space, a set must not be used by several threads at once.
+ */
+
+struct wildset {
+  size_t maxpat, maxstate, maxaccept;
+  size_t nbytes;               /* patterns with BYTES */
+  struct wildprog **prog;
+  struct nfa nfa;
+  struct nrun run;
+};
+
+struct wildset *
+wildset_new(void)
+{
+  return calloc(1, sizeof(struct wildset));
+}
+
+/** resize *pp to n elements of given size */
+static bool
+resize(void *pp, size_t n, size_t size)
+{
+  void *p = realloc(*(void **) pp, n * size);
+  if (!p) return false;
+  *(void **) pp = p;
+  return true;
+}
+
+int
+wildset_add(struct wildset *set, const char *pat, int flags)
+{
+  struct wildprog *prog;
+  struct nfa *nfa;
+  struct nrun *run;
+  size_t i, max, nstate;
+
+  if (!set || !pat) return -1;
+  if (!(prog = wildmatch_compile(pat, flags))) return -1;
+  nfa = &set->nfa;
+  run = &set->run;
+
+  if (nfa->npat + 1 > set->maxpat) {
+    for (max = set->maxpat ? set->maxpat : 16; max < nfa->npat + 1; max *= 2);
+    if (!resize(&set->prog, max, sizeof *set->prog) ||
+        !resize(&run->hits, max, sizeof *run->hits) ||
+        !resize(&run->hitmark, max, sizeof *run->hitmark))
+      goto nomem;
+    for (i = set->maxpat; i < max; i++) run->hitmark[i] = 0;
+    set->maxpat = max;
+  }
+
+  /* room for new states plus root */
+  nstate = nfa->nstate + nfasize(prog) + 1;
+  if (nstate > set->maxstate) {
+    for (max = set->maxstate ? 2 * set->maxstate : 64; max < nstate; max *= 2);
+    if (!resize(&nfa->st, max, sizeof *nfa->st) ||
+        !resize(&run->cur, max, sizeof *run->cur) ||
+        !resize(&run->next, max, sizeof *run->next) ||
+        !resize(&run->stack, max, sizeof *run->stack) ||
+        !resize(&run->mark, max, sizeof *run->mark))
+      goto nomem;
+    for (i = set->maxstate; i < max; i++) run->mark[i] = 0;
+    set->maxstate = max;
+  }
+
+  /* room for an accept entry per token */
+  if (nfa->naccept + prog->ntok > set->maxaccept) {
+    for (max = set->maxaccept ? 2 * set->maxaccept : 64;
+         max < nfa->naccept + prog->ntok; max *= 2);
+    if (!resize(&nfa->acc, max, sizeof *nfa->acc))
+      goto nomem;
+    set->maxaccept = max;
+  }
+
+  set->prog[nfa->npat] = prog;
+  if (prog->flags & WILD_BYTES) set->nbytes++;
+  if (prog->shape == SHAPE_NONE) nfa->npat++;  /* never matches */
+  else nfainsert(nfa, prog);
+  return (int) nfa->npat - 1;
+
+nomem:
+  wildmatch_free(prog);
+  return -1;
+}
+
+static int
+cmpint(const void *a, const void *b)
+{
+  int p = *(const int *) a, q = *(const int *) b;
+  return p < q ? -1 : p > q;
+}
+
+/** run the automaton of set over str (up to end), stopping at the
+    first match if any; if str had to be decoded for some patterns,
+    match those with BYTES one by one */
+static void
+setrun(struct wildset *set, const char *str, const char *end, bool any)
+{
+  struct nrun *run = &set->run;
+  size_t i;
+  nfarun(&set->nfa, run, str, end, any, set->nbytes == set->nfa.npat);
+  if (!run->decoded || set->nbytes == 0) return;
+  for (i = 0; i < set->nfa.npat && !(any && run->nhit); i++) {
+    if ((set->prog[i]->flags & WILD_BYTES) && matchprog(set->prog[i], str, end))
+      nfahit(run, (int) i);
+  }
+}
+
+int
+wildset_match(struct wildset *set, const char *str, int *ids, int maxids)
+{
+  struct nrun *run;
+  int i, n;
+  if (!set || !str) return 0;
+  run = &set->run;
+  STATBEGIN();
+  setrun(set, str, str + strlen(str), false);
+  STATEND();
+  n = (int) run->nhit;
+  qsort(run->hits, run->nhit, sizeof *run->hits, cmpint);
+  for (i = 0; i < n && i < maxids; i++)
+    ids[i] = run->hits[i];
+  return n;
+}
+
+int
+wildset_matchany(struct wildset *set, const char *str)
+{
+  if (!set || !str) return false;
+  STATBEGIN();
+  setrun(set, str, str + strlen(str), true);
+  STATEND();
+  return set->run.nhit > 0;
+}
+
+void
+wildset_free(struct wildset *set)
+{
+  size_t i;
+  if (!set) return;
+  for (i = 0; i < set->nfa.npat; i++)
+    wildmatch_free(set->prog[i]);
+  free(set->prog);
+  free(set->nfa.st);
+  free(set->nfa.acc);
+  free(set->run.cur);
+  free(set->run.next);
+  free(set->run.stack);
+  free(set->run.mark);
+  free(set->run.hits);
+  free(set->run.hitmark);
+  free(set);
+}
+
+/* About prefix queries
+ *
+ * wildmatch_prefix() runs the pattern's automaton over the prefix
+ * (as the walker does) to learn whether some, all, or none of the
+ * strings that start with it can match. The only lookahead the
+ * automaton needs is for a dot: whether a trailing "." or ".." is
+ * an initial dot (a dotfile) depends on whether a slash follows.
+ * The prefix is then checked as it is and with the continuations
+ * that make it a plain "./" or "../", and the answers are combined.
+ * Likewise, with PERIOD an empty prefix says nothing about a
+ * leading dot, which the automaton assumes absent; it cannot be
+ * ALWAYS then. A UTF-8 sequence cut short at the end of the
+ * prefix (but with BYTES) is left out: its char is not known yet,
+ * so the answer is that for the whole chars before it. With
+ * STRICT, strings that go on from the prefix may be ill-formed,
+ * so it cannot be ALWAYS either, and it is NO if the prefix is
+ * ill-formed already.
+ */
+
+/** return the end of str without an incomplete UTF-8 sequence at end */
+static const char *
+wholechars(const char *str, const char *end)
+{
+  const char *s = end;
+  int c, n;
+  while (s > str && end - s < 3 && (s[-1] & 0xC0) == 0x80) s--;
+  if (s == str || ((c = (unsigned char) s[-1]) & 0xC0) != 0xC0) return end;
+  n = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+  return end - (s - 1) < n ? s - 1 : end;
+}
+
+/** return the number of dots (1 or 2) that end str and make up its
+    last path component, else 0 */
+static int
+opendots(const char *str, const char *end)
+{
+  const char *s = end;
+  while (s > str && s[-1] == '.' && end - s < 2) s--;
+  return s < end && (s == str || s[-1] == '/') ? (int) (end - s) : 0;
+}
+
+int
+wildmatch_prefix(const char *pat, const char *prefix, int flags)
+{
+  static const char *const more[] = { "/", "./" };
+  struct wildset *set;
+  const char *end;
+  char *buf;
+  size_t len;
+  int how, i, nmore;
+
+  if (!pat || !prefix) return WILD_MAYBE;
+  if (!(set = wildset_new())) return WILD_MAYBE;
+  if (wildset_add(set, pat, flags) < 0) {
+    wildset_free(set);
+    return WILD_MAYBE;  /* out of memory: cannot rule out anything */
+  }
+  flags = set->prog[0]->flags;  /* as compiled (BYTES ignores STRICT) */
+
+  end = prefix + strlen(prefix);
+  if (!(flags & WILD_BYTES)) end = wholechars(prefix, end);
+  len = end - prefix;
+  if ((flags & WILD_STRICT) && utf8check(prefix, end) == UTF8_INVALID) {
+    wildset_free(set);
+    return WILD_NO;
+  }
+  how = nfaprefix(&set->nfa, &set->run, prefix, end, flags);
+  /* "." may go on as "./" or "../", and ".." as "../" */
+  if ((nmore = opendots(prefix, end)) > 0) nmore = 3 - nmore;
+  for (i = 0; i < nmore && how != PREFIX_MAYBE; i++) {
+    if (!(buf = malloc(len + 3))) {
+      how = PREFIX_MAYBE;
+      break;
+    }
+    memcpy(buf, prefix, len);
+    strcpy(buf + len, more[i]);
+    if (nfaprefix(&set->nfa, &set->run, buf, buf + strlen(buf), flags) != how)
+      how = PREFIX_MAYBE;
+    free(buf);
+  }
+
+  if (how == PREFIX_ALWAYS && ((len == 0 && (flags & WILD_PERIOD)) || (flags & WILD_STRICT)))
+    how = PREFIX_MAYBE;
+
+  wildset_free(set);
+  return how == PREFIX_NO ? WILD_NO : how == PREFIX_ALWAYS ? WILD_ALWAYS : WILD_MAYBE;
+}
+
+/* About the deterministic automaton
+ *
+ * Without PATHNAME, a pattern is a plain regular expression over
+ * characters, and a set of pattern positions (tokens) that may be
+ * reached by the string read so far can be advanced over one char
+ * at a time: a star stays where it is, a literal, class, or any
+ * char moves one position forward if it matches, and every star
+ * passes on to the position after it. The string matches if at its
+ * end a position is reached that may match the end of string. Each
+ * such set is a state of a deterministic automaton, so the string is
+ * matched in a single pass, no matter how the pattern looks.
+ *
+ * States are built only when they are first needed (lazily) and are
+ * kept in a cache of bounded size. Characters that match the same
+ * tokens are in the same character class; chars 0..255 find their
+ * class in a table, others by binary search over the boundaries of
+ * all ranges and literals above 255; transitions are stored per
+ * class. When the cache is full, it is emptied and the string is
+ * matched by domatch() instead. With PATHNAME, domatch() is always
+ * used. Positions are bits, and a set of positions is a bitset.
+ */
+
+#define DFA_MAXSTATE 1024
+
+enum { DS_ACCEPT = 1, DS_DEAD = 2, DS_ALL = 4 };
+
+struct wilddfa {
+  const struct wildprog *prog;
+  size_t nword, nclass, nbreak;
+  size_t maxstate, nstate, hsize;
+  unsigned short map[256];     /* class of chars 0..255 */
+  int *brk;                    /* chars from brk[i] up to brk[i+1] ... */
+  unsigned short *brkcls;      /* ... are of class brkcls[i] */
+  uint64_t *sig;               /* positions that consume each class */
+  uint64_t *star, *tail, *all; /* stars, zerotail, and what matches all */
+  uint64_t *sets, *tmp;        /* positions of each state, scratch */
+  int *trans;                  /* next state per state and class, or -1 */
+  unsigned char *flags;        /* DS_ flags per state */
+  int *hash;                   /* state indices, or -1 */
+  int start;
+};
+
+/** store the positions that consume char c into sig */
+static void
+dfasig(const struct wildprog *prog, int c, uint64_t *sig, size_t nword)
+{
+  size_t i;
+  memset(sig, 0, nword * sizeof *sig);
+  for (i = 0; i < prog->ntok; i++) {
+    const struct token *tk = &prog->tok[i];
+    if (tk->op == OP_STAR || (tk->op != OP_END && matchtoken(prog, tk, c)))
+      SETPOS(sig, i);
+  }
+}
+
+/** return class with the positions that consume c, adding it if new */
+static unsigned short
+dfaclass(struct wilddfa *dfa, int c)
+{
+  size_t k, n = dfa->nword;
+  uint64_t *sig = dfa->sig + dfa->nclass * n;
+  dfasig(dfa->prog, c, sig, n);
+  for (k = 0; k < dfa->nclass; k++)
+    if (!memcmp(dfa->sig + k * n, sig, n * sizeof *sig)) return k;
+  return dfa->nclass++;
+}
+
+/** collect boundaries of literals and ranges above 255 into brk;
+    only count them if brk is null */
+static size_t
+dfabreaks(const struct wildprog *prog, int *brk)
+{
+  size_t i, j, n = 0;
+#define ADDBRK(c) do { if ((c) > 256) { if (brk) brk[n] = (c); n++; } } while (0)
+  if (brk) brk[n] = 256;
+  n++;
+  for (i = 0; i < prog->ntok; i++) {
+    const struct token *tk = &prog->tok[i];
+    if (tk->op == OP_LIT) {
+      ADDBRK(tk->c); ADDBRK(tk->c + 1);
+      ADDBRK(tk->alt); ADDBRK(tk->alt + 1);
+    }
+    else if (tk->op == OP_CLASS) {
+      const struct cclass *cls = &prog->cls[tk->c];
+      for (j = 0; j < cls->count; j++) {
+        ADDBRK(prog->rng[cls->first + j].lo);
+        ADDBRK(prog->rng[cls->first + j].hi + 1);
+      }
+    }
+  }
+#undef ADDBRK
+  return n;
+}
+
+/** return class of char c */
+static unsigned short
+charclass(const struct wilddfa *dfa, int c)
+{
+  size_t lo = 0, hi = dfa->nbreak;
+  if (c < 256) return dfa->map[c];
+  while (hi - lo > 1) {  /* last brk[lo] <= c */
+    size_t mid = lo + (hi - lo) / 2;
+    if (c < dfa->brk[mid]) hi = mid; else lo = mid;
+  }
+  return dfa->brkcls[lo];
+}
+
+/** let every star in set also pass on to the following position */
+static void
+dfaclose(const struct wilddfa *dfa, uint64_t *set)
+{
+  size_t w;
+  bool more;
+  do {
+    uint64_t carry = 0;
+    more = false;
+    for (w = 0; w < dfa->nword; w++) {
+      uint64_t x = set[w] & dfa->star[w];
+      uint64_t y = set[w] | x << 1 | carry;
+      carry = x >> 63;
+      if (y != set[w]) more = true;
+      set[w] = y;
+    }
+  } while (more);
+}
+
+/** return state with positions set, adding it if new, or -1 if full */
+static int
+dfastate(struct wilddfa *dfa, const uint64_t *set)
+{
+  size_t k, w, n = dfa->nword, h = 2166136261u;
+  uint64_t *p;
+  unsigned char flags = DS_DEAD;
+  int s;
+
+  for (w = 0; w < n; w++)
+    h = (h ^ (size_t) (set[w] ^ set[w] >> 32)) * 16777619u;
+  for (h &= dfa->hsize - 1; (s = dfa->hash[h]) >= 0; h = (h+1) & (dfa->hsize - 1))
+    if (!memcmp(dfa->sets + s * n, set, n * sizeof *set)) return s;
+  if (dfa->nstate >= dfa->maxstate) return -1;
+
+  s = (int) dfa->nstate++;
+  dfa->hash[h] = s;
+  p = dfa->sets + s * n;
+  memcpy(p, set, n * sizeof *set);
+  for (k = 0; k < dfa->nclass; k++)
+    dfa->trans[s * dfa->nclass + k] = -1;
+  for (w = 0; w < n; w++) {
+    if (p[w]) flags &= ~DS_DEAD;
+    if (p[w] & dfa->tail[w]) flags |= DS_ACCEPT;
+    if (p[w] & dfa->all[w]) flags |= DS_ALL;
+  }
+  dfa->flags[s] = flags;
+  return s;
+}
+
+/** forget all states and add the start state again */
+static void
+dfareset(struct wilddfa *dfa)
+{
+  size_t i;
+  for (i = 0; i < dfa->hsize; i++) dfa->hash[i] = -1;
+  dfa->nstate = 0;
+  memset(dfa->tmp, 0, dfa->nword * sizeof *dfa->tmp);
+  SETPOS(dfa->tmp, 0);
+  dfaclose(dfa, dfa->tmp);
+  dfa->start = dfastate(dfa, dfa->tmp);
+}
+
+/** return the state after state s reads a char of class k, or -1 if full */
+static int
+dfanext(struct wilddfa *dfa, int s, unsigned short k)
+{
+  const uint64_t *set = dfa->sets + s * dfa->nword;
+  const uint64_t *sig = dfa->sig + k * dfa->nword;
+  uint64_t carry = 0;
+  size_t w;
+  int t;
+
+  for (w = 0; w < dfa->nword; w++) {
+    uint64_t x = set[w] & sig[w];
+    uint64_t y = x & ~dfa->star[w];  /* moves on */
+    dfa->tmp[w] = (x & dfa->star[w]) | y << 1 | carry;
+    carry = y >> 63;
+  }
+  dfaclose(dfa, dfa->tmp);
+  if ((t = dfastate(dfa, dfa->tmp)) >= 0)
+    dfa->trans[s * dfa->nclass + k] = t;
+  return t;
+}
+
+struct wilddfa *
+wilddfa_new(const struct wildprog *prog, size_t maxstate)
+{
+  struct wilddfa *dfa;
+  size_t i, n, nb, maxclass;
+  int j;
+
+  if (!prog) return 0;
+  if (!(dfa = calloc(1, sizeof *dfa))) return 0;
+  dfa->prog = prog;
+  if (prog->flags & WILD_PATHNAME) return dfa;  /* domatch only */
+
+  if (maxstate < 2) maxstate = DFA_MAXSTATE;
+  n = dfa->nword = (prog->ntok + 63) / 64;
+  nb = dfabreaks(prog, 0);
+  maxclass = 256 + nb;
+  for (dfa->hsize = 4; dfa->hsize < 2 * maxstate; dfa->hsize *= 2);
+  dfa->maxstate = maxstate;
+  if (!(dfa->brk = malloc(nb * sizeof *dfa->brk)) ||
+      !(dfa->brkcls = malloc(nb * sizeof *dfa->brkcls)) ||
+      !(dfa->sig = malloc((maxclass + 1) * n * sizeof *dfa->sig)) ||
+      !(dfa->star = calloc(4 * n, sizeof *dfa->star)) ||
+      !(dfa->sets = malloc(maxstate * n * sizeof *dfa->sets)) ||
+      !(dfa->flags = malloc(maxstate)) ||
+      !(dfa->hash = malloc(dfa->hsize * sizeof *dfa->hash)))
+    goto nomem;
+  dfa->tail = dfa->star + n;
+  dfa->all = dfa->tail + n;
+  dfa->tmp = dfa->all + n;
+
+  /* stars, positions that may end, and stars that match all the rest */
+  for (i = 0; i < prog->ntok; i++) {
+    if (prog->tok[i].op == OP_STAR) SETPOS(dfa->star, i);
+    if (prog->tok[i].zerotail) SETPOS(dfa->tail, i);
+  }
+  for (j = (int) prog->ntok - 2; j >= 0 && prog->tok[j].op == OP_STAR; j--)
+    SETPOS(dfa->all, j);
+
+  /* character classes */
+  for (j = 0; j < 256; j++)
+    dfa->map[j] = dfaclass(dfa, j);
+  dfabreaks(prog, dfa->brk);
+  qsort(dfa->brk, nb, sizeof *dfa->brk, cmpint);
+  for (i = 0; i < nb; i++)
+    if (i == 0 || dfa->brk[i] != dfa->brk[dfa->nbreak-1])
+      dfa->brk[dfa->nbreak++] = dfa->brk[i];
+  for (i = 0; i < dfa->nbreak; i++)
+    dfa->brkcls[i] = dfaclass(dfa, dfa->brk[i]);
+
+  if (!(dfa->trans = malloc(maxstate * dfa->nclass * sizeof *dfa->trans)))
+    goto nomem;
+  dfareset(dfa);
+  return dfa;
+
+nomem:
+  wilddfa_free(dfa);
+  return 0;
+}
+
+/** match str (up to end) with the automaton */
+static bool
+dfamatch(struct wilddfa *dfa, const char *str, const char *end)
+{
+  const struct wildprog *prog = dfa->prog;
+  const char *s = str;
+  int enc = FLAGENC(prog->flags), t = dfa->start;
+
+  if ((prog->flags & WILD_STRICT) && (enc = utf8check(str, end)) == UTF8_INVALID)
+    return false;
+  if (prog->shape) return matchshape(prog, str, end);
+  if (!prefilter(prog, str, end)) return false;
+  if (!dfa->maxstate)
+    return domatch(prog, str, end, enc);
+  if ((prog->flags & WILD_PERIOD) && str < end && *str == '.' &&
+      !ISLIT(prog->tok, '.') && isdotfile(*str, str+1, end))
+    return false;
+
+  if (enc == UTF8_UNKNOWN) enc = utf8check(str, end);
+  while (s < end && !(dfa->flags[t] & (DS_DEAD|DS_ALL))) {
+    int c = nextchar(&s, end, enc);
+    unsigned short k = charclass(dfa, c);
+    int u = dfa->trans[t * dfa->nclass + k];
+    if (u < 0 && (u = dfanext(dfa, t, k)) < 0) {
+      dfareset(dfa);  /* cache full */
+      STAT(giveups);
+      return domatch(prog, str, end, enc);
+    }
+    t = u;
+  }
+  if (dfa->flags[t] & DS_ALL) return true;
+  return dfa->flags[t] & DS_ACCEPT;
+}
+
+/** same as dfamatch, counted as a call */
+static bool
+dfaexec(struct wilddfa *dfa, const char *str, const char *end)
+{
+  bool r;
+  STATBEGIN();
+  r = dfamatch(dfa, str, end);
+  STATEND();
+  return r;
+}
+
+int
+wilddfa_exec(struct wilddfa *dfa, const char *str)
+{
+  if (!dfa || !str) return false;
+  return dfaexec(dfa, str, str + strlen(str));
+}
+
+int
+wilddfa_execn(struct wilddfa *dfa, const char *str, size_t len)
+{
+  if (!dfa || !str) return false;
+  return dfaexec(dfa, str, strend(str, len));
+}
+
+void
+wilddfa_free(struct wilddfa *dfa)
+{
+  if (!dfa) return;
+  free(dfa->brk);
+  free(dfa->brkcls);
+  free(dfa->sig);
+  free(dfa->star);
+  free(dfa->sets);
+  free(dfa->trans);
+  free(dfa->flags);
+  free(dfa->hash);
+  free(dfa);
+}
+
+/* About walking directories
+ *
+ * wildglob() finds all paths below a root directory that match a
+ * pattern (with PATHNAME). Directories are read with openat() and
+ * readdir() (which reads many entries per system call), and the
+ * type of each entry is taken from the entry itself (d_type), so
+ * no stat() is needed on most file systems. Symbolic links are
+ * reported, but not followed.
+ *
+ * Leading pattern components without wildcards (and without
+ * CASEFOLD) are opened directly, one by one and not through links,
+ * without reading the directories on the way; this stops at an
+ * empty, "." or ".." component, which a path found has not.
+ * Before going into a subdirectory, the pattern's automaton (see
+ * above) is run over its path (with a trailing slash) to see if
+ * any path below can match; if not, the whole
+ * subtree is skipped, and if all paths below match (a trailing
+ * globstar has been reached), they are reported without matching.
+ * So a globstar expands only where the rest of the pattern may
+ * match. Each path found is matched with the compiled pattern, so
+ * the result is exactly that of wildmatch() on all paths below root.
+ */
+
+struct walk {
+  const struct wildprog *prog;
+  struct wildset *set;         /* automaton for pruning */
+  wildglob_fn *fn;
+  void *arg;
+  char *path;                  /* path relative to root */
+  size_t len, cap;
+  bool slash;                  /* pattern ends with slash */
+  struct gthread *self;        /* thread of a parallel walk, else null */
+};
+
+/** make room for n more chars (and a NUL) in the path */
+static bool
+pathroom(struct walk *w, size_t n)
+{
+  size_t cap = w->cap ? w->cap : 256;
+  while (cap < w->len + n + 1) cap *= 2;
+  if (cap > w->cap) {
+    if (!resize(&w->path, cap, 1)) return false;
+    w->cap = cap;
+  }
+  return true;
+}
+
+/** report directory or file at path if all or if it matches;
+    return the callback's result */
+static int
+walkreport(struct walk *w, bool isdir, bool all)
+{
+  int r = 0;
+  if (isdir && w->slash) {  /* only directories match a trailing slash */
+    w->path[w->len] = '/';
+    w->path[w->len+1] = 0;
+  }
+  if (all || wildmatch_exec(w->prog, w->path))
+    r = w->fn(w->path, w->arg);
+  w->path[w->len] = 0;
+  return r;
+}
+
+static int globpush(struct walk *w, bool all);
+
+/** walk the directory open at fd, whose path (ending with a slash,
+    unless empty) is in w->path; report all entries if all; return
+    nonzero if the callback said so or -1 if out of memory */
+static int
+walkdir(struct walk *w, int fd, bool all)
+{
+  DIR *dir;
+  struct dirent *de;
+  size_t len = w->len;
+  int r = 0;
+
+  if (!(dir = fdopendir(fd))) {
+    close(fd);
+    return 0;  /* skip what cannot be read */
+  }
+  while (r == 0 && (de = readdir(dir))) {
+    const char *name = de->d_name;
+    size_t n = strlen(name);
+    bool isdir = false;
+    struct stat st;
+    int how, sub;
+
+    if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+      continue;
+    if ((w->prog->flags & WILD_STRICT) && utf8check(name, name + n) == UTF8_INVALID)
+      continue;  /* neither it nor anything below can match */
+    if (!pathroom(w, n + 1)) { r = -1; break; }
+    memcpy(w->path + len, name, n + 1);
+    w->len = len + n;
+
+#ifdef DT_DIR
+    if (de->d_type == DT_DIR) isdir = true;
+    else if (de->d_type == DT_UNKNOWN)
+#endif
+      isdir = !fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) && S_ISDIR(st.st_mode);
+
+    if ((r = walkreport(w, isdir, all)) != 0) break;
+    if (!isdir) continue;
+
+    w->path[w->len++] = '/';
+    w->path[w->len] = 0;
+    how = all ? PREFIX_ALWAYS : nfaprefix(&w->set->nfa, &w->set->run, w->path,
+                                          w->path + w->len, w->prog->flags);
+    if (how == PREFIX_NO)
+      continue;
+    if (w->self)  /* parallel: leave it to any thread */
+      r = globpush(w, how == PREFIX_ALWAYS);
+    else {
+      sub = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (sub >= 0) r = walkdir(w, sub, how == PREFIX_ALWAYS);
+    }
+  }
+  w->len = len;
+  w->path[len] = 0;
+  closedir(dir);
+  return r;
+}
+
+/** return length of the leading pattern components (with their
+    slashes) that have no wildcards and are not empty, "." or "..",
+    which no path found by walking has */
+static size_t
+literaldirs(const char *pat, int flags)
+{
+  size_t i, n = 0;
+  if (flags & WILD_CASEFOLD) return 0;
+  for (i = 0; pat[i] && !strchr("*?[", pat[i]); i++) {
+    if (pat[i] != '/') continue;
+    if (i == n || (pat[n] == '.' && (i == n + 1 || (pat[n+1] == '.' && i == n + 2))))
+      break;
+    n = i + 1;
+  }
+  return n;
+}
+
+/** set up w (with fn and arg already set) to walk below root; report
+    the directories of leading literal components; return 0 and the
+    directory to walk in *fd (or -1 if none), or else nonzero */
+static int
+globopen(struct walk *w, const char *root, const char *pat, int flags, int *fd)
+{
+  size_t i, j, n;
+  int r = 0, sub;
+
+  *fd = -1;
+  if (!root || !pat || !w->fn) {
+    errno = EINVAL;
+    return -1;
+  }
+  flags |= WILD_PATHNAME;
+  n = strlen(pat);
+  w->slash = n > 0 && pat[n-1] == '/';
+  n = literaldirs(pat, flags);
+
+  if (!(w->prog = wildmatch_compile(pat, flags)) || !(w->set = wildset_new()) ||
+      wildset_add(w->set, pat, flags) < 0 || !pathroom(w, n + 1)) {
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(w->path, pat, n);
+  w->path[n] = 0;
+
+  if ((*fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return -1;
+  for (i = 0; i < n; i = j + 1) {  /* open leading literal directories directly */
+    for (j = i; w->path[j] != '/'; j++);
+    w->path[j] = 0;  /* one at a time, so that links are not followed */
+    sub = openat(*fd, w->path + i, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    w->path[j] = '/';
+    close(*fd);
+    if ((*fd = sub) < 0)
+      return errno == ENOENT || errno == ENOTDIR || errno == ELOOP ? 0 : -1;
+  }
+
+  /* the directories on the way may match, too */
+  for (i = 0; r == 0 && i + 1 < n; i++) {
+    if (w->path[i+1] != '/' || w->path[i] == '/') continue;
+    w->len = i + 1;
+    w->path[w->len] = 0;
+    r = walkreport(w, true, false);
+    memcpy(w->path, pat, n);
+  }
+  w->len = n;
+  w->path[n] = 0;
+  if (r != 0) {
+    close(*fd);
+    *fd = -1;
+  }
+  return r;
+}
+
+/** release what globopen() allocated */
+static void
+globclose(struct walk *w)
+{
+  free(w->path);
+  wildset_free(w->set);
+  wildmatch_free((struct wildprog *) w->prog);
+}
+
+int
+wildglob(const char *root, const char *pat, int flags, wildglob_fn *fn, void *arg)
+{
+  struct walk w;
+  int fd, r;
+
+  memset(&w, 0, sizeof w);
+  w.fn = fn;
+  w.arg = arg;
+  r = globopen(&w, root, pat, flags, &fd);
+  if (r == 0 && fd >= 0 && (r = walkdir(&w, fd, false)) == -1)
+    errno = ENOMEM;
+  globclose(&w);
+  return r;
+}
+
+/* About walking directories in parallel
+ *
+ * wildglob_parallel() reads directories with several threads. A
+ * directory to be read is an item in the queue of the thread that
+ * found it: its path, and its parent directory, which stays open
+ * (shared by all its items, with a count of them) until the last
+ * of them has been opened. So each directory is opened by its name
+ * in its parent, as when walking with one thread, and not through
+ * a link or a path that may be too long. A thread takes its newest
+ * item (going depth-first through its own subtree) and, when it
+ * has none left, steals the oldest item of another thread (likely
+ * a large subtree); each queue has its own lock. A count of items
+ * that are queued or being read tells when the walk is done;
+ * threads without work sleep until new items arrive.
+ *
+ * Each thread collects the paths it finds in its own buffer, and
+ * passes them to the callback in batches: once it holds GLOB_BATCH
+ * bytes of them after reading a directory, and whenever the thread
+ * runs out of items. The callback is called by one thread at a
+ * time, so it need not be thread-safe; that takes a lock, which is
+ * kept on purpose: a lock-free merge of the buffers would still
+ * have to hand them to a single caller. Taken once per batch
+ * rather than once per directory, the lock is rarely contended.
+ * When the callback returns non-zero, it is not called again, and
+ * the items left are dropped without reading.
+ */
+
+#define GLOB_BATCH 65536       /* bytes of paths passed on at once */
+
+struct gdir {
+  int fd;                      /* open directory */
+  size_t refs;                 /* its items, and the thread reading it */
+};
+
+struct diritem {
+  char *path;                  /* relative, ending with a slash unless empty */
+  struct gdir *parent;         /* null for where the walk starts */
+  bool all;                    /* all paths below match */
+};
+
+struct gqueue {
+  pthread_mutex_t lock;
+  struct diritem *items;       /* items[head..n-1] are queued */
+  size_t head, n, max;
+  char pad[64];                /* keep queues on separate cache lines */
+};
+
+struct gthread {
+  struct pglob *g;
+  struct walk w;               /* own automaton and path */
+  char *out;                   /* paths found, each ending with NUL */
+  size_t nout, maxout;
+  int fd;                      /* directory being read */
+  struct gdir *dir;            /* the same, once it has items */
+  int id;
+  bool nomem;
+  pthread_t thread;
+};
+
+struct pglob {
+  int nthread, rootfd;         /* rootfd: directory where the walk starts */
+  struct gqueue *q;
+  struct gthread *t;
+  wildglob_fn *fn;
+  void *arg;
+  pthread_mutex_t report;      /* for calling fn, and result */
+  int result;                  /* non-zero result of fn */
+  pthread_mutex_t lock;        /* for the counts below */
+  pthread_cond_t wake;
+  size_t pending;              /* items queued or being read */
+  size_t queued;               /* items queued */
+  int idle;                    /* threads waiting for items */
+  bool stop;                   /* fn said so: drop the items left */
+};
+
+/** callback of thread walks: save path in the thread's buffer */
+static int
+globsave(const char *path, void *arg)
+{
+  struct gthread *t = arg;
+  size_t n = strlen(path) + 1, max = t->maxout ? t->maxout : 4096;
+  while (max < t->nout + n) max *= 2;
+  if (max > t->maxout) {
+    if (!resize(&t->out, max, 1)) return -1;
+    t->maxout = max;
+  }
+  memcpy(t->out + t->nout, path, n);
+  t->nout += n;
+  return 0;
+}
+
+/** pass the paths in the thread's buffer to the callback, unless it
+    stopped the walk; return its non-zero result if it did */
+static int
+globflush(struct gthread *t)
+{
+  struct pglob *g = t->g;
+  size_t i;
+  int r;
+
+  pthread_mutex_lock(&g->report);
+  for (i = 0; g->result == 0 && i < t->nout; i += strlen(t->out + i) + 1)
+    g->result = g->fn(t->out + i, g->arg);
+  r = g->result;
+  pthread_mutex_unlock(&g->report);
+  t->nout = 0;
+  return r;
+}
+
+/** drop a reference to d (under the walk's lock); return d if it was
+    the last one, for the caller to close */
+static struct gdir *
+gdirdrop(struct gdir *d)
+{
+  return d && --d->refs == 0 ? d : 0;
+}
+
+/** close and free d, if any */
+static void
+gdirclose(struct gdir *d)
+{
+  if (!d) return;
+  close(d->fd);
+  free(d);
+}
+
+/** queue the directory at w->path, found in the directory being read,
+    for any thread to read */
+static int
+globpush(struct walk *w, bool all)
+{
+  struct gthread *t = w->self;
+  struct pglob *g = t->g;
+  struct gqueue *q = &g->q[t->id];
+  char *path;
+  bool ok = true;
+
+  if (!t->dir) {  /* keep the directory open for its items */
+    int fd = fcntl(t->fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) return 0;  /* skip what cannot be read */
+    if (!(t->dir = malloc(sizeof *t->dir))) {
+      close(fd);
+      return -1;
+    }
+    t->dir->fd = fd;
+    t->dir->refs = 1;
+  }
+  if (!(path = malloc(w->len + 1))) return -1;
+  memcpy(path, w->path, w->len + 1);
+
+  pthread_mutex_lock(&g->lock);
+  g->pending++;  /* before the item can be taken */
+  t->dir->refs++;
+  pthread_mutex_unlock(&g->lock);
+
+  pthread_mutex_lock(&q->lock);
+  if (q->head > 0 && q->n == q->max) {  /* reuse room at front */
+    memmove(q->items, q->items + q->head, (q->n - q->head) * sizeof *q->items);
+    q->n -= q->head;
+    q->head = 0;
+  }
+  if (q->n == q->max) {
+    size_t max = q->max ? 2 * q->max : 64;
+    if ((ok = resize(&q->items, max, sizeof *q->items))) q->max = max;
+  }
+  if (ok) {
+    q->items[q->n].path = path;
+    q->items[q->n].parent = t->dir;
+    q->items[q->n++].all = all;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  pthread_mutex_lock(&g->lock);
+  if (!ok) {
+    g->pending--;
+    t->dir->refs--;  /* the thread still holds one */
+  }
+  else {
+    g->queued++;
+    if (g->idle > 0) pthread_cond_signal(&g->wake);
+  }
+  pthread_mutex_unlock(&g->lock);
+  if (!ok) free(path);
+  return ok ? 0 : -1;
+}
+
+/** take own newest item, or else another thread's oldest */
+static bool
+globtake(struct pglob *g, int k, struct diritem *item)
+{
+  struct gqueue *q = &g->q[k];
+  int i;
+  bool r = false;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->n > q->head) {
+    *item = q->items[--q->n];
+    r = true;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  for (i = 1; !r && i < g->nthread; i++) {
+    q = &g->q[(k + i) % g->nthread];
+    pthread_mutex_lock(&q->lock);
+    if (q->n > q->head) {
+      *item = q->items[q->head++];
+      r = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+  if (r) {
+    pthread_mutex_lock(&g->lock);
+    g->queued--;
+    pthread_mutex_unlock(&g->lock);
+  }
+  return r;
+}
+
+/** open the directory of item (its path copied to w->path) */
+static int
+globopenitem(struct pglob *g, struct walk *w, const struct diritem *item)
+{
+  size_t i = w->len - 1;
+  int fd;
+
+  if (!item->parent)
+    return openat(g->rootfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  while (i > 0 && w->path[i-1] != '/') i--;  /* its name, without the slash */
+  w->path[w->len-1] = 0;
+  fd = openat(item->parent->fd, w->path + i, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  w->path[w->len-1] = '/';
+  return fd;
+}
+
+/** read directories until all are done */
+static void *
+globwork(void *arg)
+{
+  struct gthread *t = arg;
+  struct pglob *g = t->g;
+  struct walk *w = &t->w;
+  struct diritem item;
+  struct gdir *parent, *dir;
+  size_t n;
+  bool stop = false;
+
+  for (;;) {
+    if (!globtake(g, t->id, &item)) {
+      bool done;
+      if (t->nout > 0 && globflush(t) != 0)
+        stop = true;  /* report before waiting */
+      pthread_mutex_lock(&g->lock);
+      if (stop) g->stop = true;
+      g->idle++;
+      while (g->queued == 0 && g->pending > 0)
+        pthread_cond_wait(&g->wake, &g->lock);
+      g->idle--;
+      done = g->pending == 0;
+      pthread_mutex_unlock(&g->lock);
+      if (done) break;
+      continue;
+    }
+
+    n = strlen(item.path);
+    t->dir = 0;
+    if (stop)  /* drop it */
+      ;
+    else if (!pathroom(w, n))
+      t->nomem = true;
+    else {
+      memcpy(w->path, item.path, n + 1);
+      w->len = n;
+      t->fd = globopenitem(g, w, &item);
+      if (t->fd >= 0 && walkdir(w, t->fd, item.all) == -1)
+        t->nomem = true;
+      if (t->nout >= GLOB_BATCH)
+        stop = globflush(t) != 0;
+    }
+    free(item.path);
+
+    pthread_mutex_lock(&g->lock);
+    parent = gdirdrop(item.parent);
+    dir = gdirdrop(t->dir);
+    if (stop) g->stop = true;
+    stop = g->stop;
+    if (--g->pending == 0)
+      pthread_cond_broadcast(&g->wake);  /* all done */
+    pthread_mutex_unlock(&g->lock);
+    gdirclose(parent);
+    gdirclose(dir);
+  }
+  return 0;
+}
+
+int
+wildglob_parallel(const char *root, const char *pat, int flags, int nthreads,
+                  wildglob_fn *fn, void *arg)
+{
+  struct pglob g;
+  struct walk w;
+  int k, r, started;
+  bool nomem = false;
+
+  if (nthreads <= 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = n > 0 ? (int) n : 1;
+  }
+  memset(&w, 0, sizeof w);
+  w.fn = fn;
+  w.arg = arg;
+  r = globopen(&w, root, pat, flags, &g.rootfd);
+  if (r != 0 || g.rootfd < 0) {
+    globclose(&w);
+    return r;
+  }
+
+  g.nthread = nthreads;
+  g.fn = fn;
+  g.arg = arg;
+  g.result = 0;
+  g.pending = g.queued = 0;
+  g.idle = 0;
+  g.stop = false;
+  g.q = calloc(nthreads, sizeof *g.q);
+  g.t = calloc(nthreads, sizeof *g.t);
+  if (!g.q || !g.t) {
+    free(g.q);
+    free(g.t);
+    close(g.rootfd);
+    globclose(&w);
+    errno = ENOMEM;
+    return -1;
+  }
+  pthread_mutex_init(&g.report, 0);
+  pthread_mutex_init(&g.lock, 0);
+  pthread_cond_init(&g.wake, 0);
+  for (k = 0; k < nthreads; k++) {
+    struct gthread *t = &g.t[k];
+    pthread_mutex_init(&g.q[k].lock, 0);
+    t->g = &g;
+    t->id = k;
+    t->w.prog = w.prog;
+    t->w.slash = w.slash;
+    t->w.fn = globsave;
+    t->w.arg = t;
+    t->w.self = t;
+    if (!(t->w.set = wildset_new()) || wildset_add(t->w.set, pat, flags | WILD_PATHNAME) < 0)
+      nomem = true;
+  }
+
+  /* the first item is where the walk starts */
+  if (!nomem && (g.q[0].items = malloc(sizeof *g.q[0].items)) &&
+      (g.q[0].items->path = malloc(w.len + 1))) {
+    memcpy(g.q[0].items->path, w.path, w.len + 1);
+    g.q[0].items->parent = 0;
+    g.q[0].items->all = false;
+    g.q[0].n = g.q[0].max = 1;
+    g.pending = g.queued = 1;
+  }
+  else nomem = true;
+  if (!nomem) {
+    for (started = 1; started < nthreads; started++)
+      if (pthread_create(&g.t[started].thread, 0, globwork, &g.t[started]))
+        break;
+    globwork(&g.t[0]);
+    for (k = 1; k < started; k++)
+      pthread_join(g.t[k].thread, 0);
+  }
+  r = g.result;
+
+  for (k = 0; k < nthreads; k++) {
+    struct gthread *t = &g.t[k];
+    if (t->nomem) nomem = true;
+    free(t->out);
+    free(t->w.path);
+    wildset_free(t->w.set);
+    while (g.q[k].head < g.q[k].n) {  /* left over if out of memory */
+      struct diritem *item = &g.q[k].items[g.q[k].head++];
+      gdirclose(gdirdrop(item->parent));
+      free(item->path);
+    }
+    free(g.q[k].items);
+    pthread_mutex_destroy(&g.q[k].lock);
+  }
+  pthread_mutex_destroy(&g.report);
+  pthread_mutex_destroy(&g.lock);
+  pthread_cond_destroy(&g.wake);
+  free(g.q);
+  free(g.t);
+  close(g.rootfd);
+  globclose(&w);
+  if (r == 0 && nomem) {
+    errno = ENOMEM;
+    r = -1;
+  }
+  return r;
 }
@@ -4,8 +4,139 @@
 #define WILD_CASEFOLD  1
 #define WILD_PATHNAME  2
 #define WILD_PERIOD    4
+#define WILD_UNIFOLD   8
+#define WILD_STRICT   16
+#define WILD_BYTES    32
+
+#include <stddef.h>
+#include <stdint.h>
 
 /** wildcard matching, supporting * ** ? [] */
 int wildmatch(const char *pat, const char *str, int flags);
 
+/** same as wildmatch, but pat and str are the first patlen and len
+    bytes (or up to a NUL byte) and need not be NUL-terminated */
+int wildmatchn(const char *pat, size_t patlen, const char *str, size_t len, int flags);
+
+#define WILD_NO      0
+#define WILD_MAYBE   1
+#define WILD_ALWAYS  2
+
+/** return WILD_NO if no string starting with prefix matches pat,
+    WILD_ALWAYS if all of them do, else WILD_MAYBE (some may match);
+    WILD_MAYBE also if out of memory */
+int wildmatch_prefix(const char *pat, const char *prefix, int flags);
+
+/** compiled pattern, for matching the same pattern many times */
+struct wildprog;
+
+/** compile pat with flags; return 0 if out of memory */
+struct wildprog *wildmatch_compile(const char *pat, int flags);
+
+/** compile the first patlen bytes of pat (or up to a NUL byte) */
+struct wildprog *wildmatch_compilen(const char *pat, size_t patlen, int flags);
+
+/** match str against compiled pattern, same result as wildmatch */
+int wildmatch_exec(const struct wildprog *prog, const char *str);
+
+/** match the first len bytes of str (or up to a NUL byte) */
+int wildmatch_execn(const struct wildprog *prog, const char *str, size_t len);
+
+/** match strs[0..n-1] against compiled pattern, set bit i%64 of
+    bits[i/64] iff strs[i] matches (others cleared); return the number
+    of matching strings */
+size_t wildmatch_batch(const struct wildprog *prog, const char *const *strs,
+                       size_t n, uint64_t *bits);
+
+/** pool of threads, for matching batches of strings in parallel */
+struct wildpool;
+
+/** create a pool of nthreads threads, including the calling thread
+    (0 for one per processor); return 0 if out of memory */
+struct wildpool *wildpool_new(int nthreads);
+
+/** same as wildmatch_batch, but with the strings shared among the
+    threads of pool */
+size_t wildpool_batch(struct wildpool *pool, const struct wildprog *prog,
+                      const char *const *strs, size_t n, uint64_t *bits);
+
+/** stop the threads and release the pool */
+void wildpool_free(struct wildpool *pool);
+
+/** release a compiled pattern */
+void wildmatch_free(struct wildprog *prog);
+
+/** set of patterns, for matching many patterns in one pass */
+struct wildset;
+
+/** create an empty pattern set; return 0 if out of memory */
+struct wildset *wildset_new(void);
+
+/** add pat with flags to set; return its id (0, 1, ...) or -1 if out
+    of memory */
+int wildset_add(struct wildset *set, const char *pat, int flags);
+
+/** store ids of (up to maxids) patterns matching str in ascending
+    order into ids; return the number of matching patterns */
+int wildset_match(struct wildset *set, const char *str, int *ids, int maxids);
+
+/** return true iff any pattern in set matches str */
+int wildset_matchany(struct wildset *set, const char *str);
+
+/** release a pattern set and its patterns */
+void wildset_free(struct wildset *set);
+
+/** lazily built deterministic automaton for a compiled pattern */
+struct wilddfa;
+
+/** create an automaton for prog (which must outlive it), caching at
+    most maxstate states (0 for a default); return 0 if out of memory */
+struct wilddfa *wilddfa_new(const struct wildprog *prog, size_t maxstate);
+
+/** match str with the automaton, same result as wildmatch_exec */
+int wilddfa_exec(struct wilddfa *dfa, const char *str);
+
+/** match the first len bytes of str (or up to a NUL byte) */
+int wilddfa_execn(struct wilddfa *dfa, const char *str, size_t len);
+
+/** release an automaton (but not its compiled pattern) */
+void wilddfa_free(struct wilddfa *dfa);
+
+/** callback for each path found by wildglob; return 0 to go on */
+typedef int wildglob_fn(const char *path, void *arg);
+
+/** call fn(path, arg) for each path below directory root (relative to
+    root) that matches pat (with WILD_PATHNAME added to flags); return 0
+    when done, the callback's result if nonzero, or -1 on error (root
+    cannot be opened, out of memory) with errno set */
+int wildglob(const char *root, const char *pat, int flags, wildglob_fn *fn, void *arg);
+
+/** same as wildglob, but read directories with nthreads threads (0 for
+    one per processor); fn is called from any of them, but by one at a
+    time, with the paths a thread has found, in batches */
+int wildglob_parallel(const char *root, const char *pat, int flags, int nthreads,
+                      wildglob_fn *fn, void *arg);
+
+/** counters of the work done by matching (see WILDMATCH_STATS) */
+struct wildmatch_stats {
+  unsigned long calls;       /* strings matched */
+  unsigned long decoded;     /* UTF-8 chars decoded */
+  unsigned long steps;       /* pattern tokens tried, directories skipped */
+  unsigned long backtracks;  /* returns to the last star */
+  unsigned long classes;     /* tests of a char against a [class] */
+  unsigned long globstars;   /* tries of a globstar */
+  unsigned long memohits;    /* globstar tries known to fail */
+  unsigned long maxdepth;    /* most globstars tried at once */
+  unsigned long giveups;     /* out of memory, or automaton cache full */
+};
+
+/** store the counters of the calling thread for its last string
+    matched into last, and the sums over all its strings since the last
+    reset into total (maxdepth is the maximum); either may be 0; return
+    0 (and store zeros) unless compiled with WILDMATCH_STATS */
+int wildmatch_stats(struct wildmatch_stats *last, struct wildmatch_stats *total);
+
+/** reset the counters of the calling thread */
+void wildmatch_stats_reset(void);
+
 #endif